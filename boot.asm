@@ -30,6 +30,10 @@ _start:
     mov gs,ax
     mov ss,ax
     mov esp, stack_top
+    ; GCC assumes a 16-byte aligned stack at every call and spills SSE
+    ; registers with aligned stores, so kmain must start aligned
+    and esp, -16
+    sub esp, 8
     push ebx
     push eax
     call kmain
@@ -46,5 +50,6 @@ gdt_descr:
 gdt_end:
 
 section .bss
+align 16
 resb 16384
 stack_top:
@@ -10,12 +10,26 @@ CFLAGS+=" -include vendor/mbedtls/include/mbedtls/platform_needed.h"
 echo "Cleaning..."
 rm -rf iso myos.iso *.o kernel.bin
 
+# Generate the UI glyph atlases with a host compiler (FONT_PSF=file.psf to
+# build them from a PSF2 font instead of the built-in 8x8 one)
+${HOSTCC:-gcc} -O2 -iquote . -o tools/mkfont tools/mkfont.c font.c psf.c
+./tools/mkfont font_ui ${FONT_UI_HEIGHT:-12} ${FONT_PSF} > font_ui.c
+
 # Compile all sources with the cross-compiler
 i686-elf-gcc -m32 -c kernel.c        ${CFLAGS} -ffreestanding -o kernel.o
 i686-elf-gcc -m32 -c graphics.c      ${CFLAGS} -ffreestanding -o graphics.o
-i686-elf-gcc -m32 -c string.c        ${CFLAGS} -ffreestanding -o string.o
+i686-elf-gcc -m32 -c wm.c            ${CFLAGS} -ffreestanding -o wm.o
+i686-elf-gcc -m32 -c gfx_blend.c     ${CFLAGS} -ffreestanding -o gfx_blend.o
+# string.c and csum.c are the hot library objects built optimised; their
+# byte loops must not be turned back into calls to memcpy/memset
+i686-elf-gcc -m32 -c string.c        ${CFLAGS} -ffreestanding -O2 -fno-tree-loop-distribute-patterns -fno-tree-vectorize -o string.o
+i686-elf-gcc -m32 -c csum.c          ${CFLAGS} -ffreestanding -O2 -fno-tree-loop-distribute-patterns -fno-tree-vectorize -o csum.o
 i686-elf-gcc -m32 -c font.c          ${CFLAGS} -ffreestanding -o font.o
+i686-elf-gcc -m32 -c font_ui.c       ${CFLAGS} -ffreestanding -o font_ui.o
+i686-elf-gcc -m32 -c psf.c           ${CFLAGS} -ffreestanding -o psf.o
 i686-elf-gcc -m32 -c mouse.c         ${CFLAGS} -ffreestanding -o mouse.o
+i686-elf-gcc -m32 -c paging.c        ${CFLAGS} -ffreestanding -o paging.o
+i686-elf-gcc -m32 -c ktime.c         ${CFLAGS} -ffreestanding -o ktime.o
 
 # New network-related modules
 i686-elf-gcc -m32 -c pci.c           ${CFLAGS} -ffreestanding -o pci.o
@@ -25,9 +39,14 @@ i686-elf-gcc -m32 -c usb/xhci.c      ${CFLAGS} -ffreestanding -o xhci.o || true
 i686-elf-gcc -m32 -c usb/nic_stub.c  ${CFLAGS} -ffreestanding -o nic_stub.o || true
 # build e1000e driver instead of rtl8139 (driver exposes rtl8139_* API for compatibility)
 i686-elf-gcc -m32 -c drivers/e1000e.c ${CFLAGS} -ffreestanding -o rtl8139.o
+i686-elf-gcc -m32 -c drivers/bga.c   ${CFLAGS} -ffreestanding -o bga.o
+i686-elf-gcc -m32 -c drivers/virtio_gpu.c ${CFLAGS} -ffreestanding -o virtio_gpu.o
 i686-elf-gcc -m32 -c net.c           ${CFLAGS} -ffreestanding -o net.o
 i686-elf-gcc -m32 -c net_demo.c      ${CFLAGS} -ffreestanding -o net_demo.o
-i686-elf-gcc -m32 -c kmalloc_stub.c  ${CFLAGS} -ffreestanding -o kmalloc_stub.o
+i686-elf-gcc -m32 -c heap.c          ${CFLAGS} -ffreestanding -o heap.o
+i686-elf-gcc -m32 -c pmm.c           ${CFLAGS} -ffreestanding -o pmm.o
+i686-elf-gcc -m32 -c dma.c           ${CFLAGS} -ffreestanding -o dma.o
+i686-elf-gcc -m32 -c fpu.c           ${CFLAGS} -ffreestanding -o fpu.o
 
 # compile syscall and ELF loader sources so kernel can call console_puts and elf32_load_and_run
 i686-elf-gcc -m32 -c syscalls.c      ${CFLAGS} -ffreestanding -o syscalls.o
@@ -93,8 +112,8 @@ i686-elf-gcc -m32 -c irqstubs.S -o irqstubs.o
 
 # Link everything into kernel.bin using compiler driver (pull in libgcc builtins)
 i686-elf-gcc -m32 -nostdlib -Wl,-melf_i386 -Wl,-T,linker.ld -Wl,-z,max-page-size=0x1000 \
-   boot.o kernel.o graphics.o string.o font.o mouse.o \
-   pci.o rtl8139.o net.o net_demo.o kmalloc_stub.o \
+   boot.o kernel.o graphics.o wm.o gfx_blend.o string.o font.o font_ui.o psf.o mouse.o paging.o bga.o virtio_gpu.o \
+   pci.o rtl8139.o net.o net_demo.o csum.o heap.o pmm.o dma.o fpu.o ktime.o \
    syscalls.o exec_elf.o ${EXTRA_OBJS} \
    tcp.o http.o dns.o tls_mbedtls.o platform_shim.o irqstubs.o \
   usb_host.o xhci.o nic_stub.o \
@@ -108,10 +127,19 @@ i686-elf-gcc -m32 -nostdlib -Wl,-melf_i386 -Wl,-T,linker.ld -Wl,-z,max-page-size
 mkdir -p iso/boot/grub
 cp kernel.bin iso/boot/
 
+# BOOT_FONT=file.psf passes a PSF2 font as a module; the kernel then draws
+# UI text with it (mono, native size) instead of the compiled-in atlas
+FONT_MODULE=""
+if [ -n "${BOOT_FONT}" ]; then
+  cp "${BOOT_FONT}" iso/boot/font.psf
+  FONT_MODULE="module2 /boot/font.psf font"
+fi
+
 cat > iso/boot/grub/grub.cfg <<EOF
 set timeout=0
 menuentry "MyOS" {
   multiboot2 /boot/kernel.bin
+  ${FONT_MODULE}
   boot
 }
 EOF
@@ -0,0 +1,106 @@
+// cpu.h — CPUID, MSR and control-register helpers
+#pragma once
+#include <stdint.h>
+
+static inline void cpuid(uint32_t leaf, uint32_t *a, uint32_t *b, uint32_t *c, uint32_t *d) {
+    uint32_t ra, rb, rc, rd;
+    asm volatile("cpuid" : "=a"(ra), "=b"(rb), "=c"(rc), "=d"(rd) : "a"(leaf), "c"(0));
+    if (a) *a = ra;
+    if (b) *b = rb;
+    if (c) *c = rc;
+    if (d) *d = rd;
+}
+
+static inline uint64_t rdmsr(uint32_t msr) {
+    uint32_t lo, hi;
+    asm volatile("rdmsr" : "=a"(lo), "=d"(hi) : "c"(msr));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+static inline void wrmsr(uint32_t msr, uint64_t val) {
+    asm volatile("wrmsr" : : "c"(msr), "a"((uint32_t)val), "d"((uint32_t)(val >> 32)));
+}
+
+static inline uint32_t read_cr0(void) {
+    uint32_t v;
+    asm volatile("mov %%cr0, %0" : "=r"(v));
+    return v;
+}
+
+static inline void write_cr0(uint32_t v) {
+    asm volatile("mov %0, %%cr0" : : "r"(v) : "memory");
+}
+
+static inline uint32_t read_cr3(void) {
+    uint32_t v;
+    asm volatile("mov %%cr3, %0" : "=r"(v));
+    return v;
+}
+
+static inline void write_cr3(uint32_t v) {
+    asm volatile("mov %0, %%cr3" : : "r"(v) : "memory");
+}
+
+static inline uint32_t read_cr4(void) {
+    uint32_t v;
+    asm volatile("mov %%cr4, %0" : "=r"(v));
+    return v;
+}
+
+static inline void write_cr4(uint32_t v) {
+    asm volatile("mov %0, %%cr4" : : "r"(v) : "memory");
+}
+
+static inline void wbinvd(void) {
+    asm volatile("wbinvd" : : : "memory");
+}
+
+static inline uint32_t irq_save(void) {
+    uint32_t flags;
+    asm volatile("pushf; pop %0; cli" : "=r"(flags) : : "memory");
+    return flags;
+}
+
+static inline void irq_restore(uint32_t flags) {
+    asm volatile("push %0; popf" : : "r"(flags) : "memory", "cc");
+}
+
+// SSE2 can be used: the CPU has it (CPUID.1:EDX.26) and the kernel has
+// enabled SSE state handling (CR4.OSFXSR).
+static inline int cpu_sse2_usable(void) {
+    uint32_t d;
+    cpuid(1, 0, 0, 0, &d);
+    return (d & (1u << 26)) && (read_cr4() & (1u << 9));
+}
+
+// Enhanced REP MOVSB/STOSB (CPUID.(EAX=7,ECX=0):EBX.9): byte rep strings
+// are the fast way to copy and fill.
+static inline int cpu_has_erms(void) {
+    uint32_t max, b;
+    cpuid(0, &max, 0, 0, 0);
+    if (max < 7) return 0;
+    cpuid(7, 0, &b, 0, 0);
+    return (b >> 9) & 1;
+}
+
+static inline uint64_t rdtsc(void) {
+    uint32_t lo, hi;
+    asm volatile("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+// Time stamp counter present (CPUID.1:EDX.4) and invariant, i.e. ticking
+// at a constant rate through P/C-state changes (CPUID.80000007H:EDX.8).
+static inline int cpu_has_tsc(void) {
+    uint32_t d;
+    cpuid(1, 0, 0, 0, &d);
+    return (d >> 4) & 1;
+}
+
+static inline int cpu_has_invariant_tsc(void) {
+    uint32_t max, d;
+    cpuid(0x80000000u, &max, 0, 0, 0);
+    if (max < 0x80000007u) return 0;
+    cpuid(0x80000007u, 0, 0, 0, &d);
+    return (d >> 8) & 1;
+}
@@ -0,0 +1,115 @@
+// csum.c — Internet checksum: 64-bit accumulation, SSE2, copy-and-sum
+#include "csum.h"
+#include "fpu.h"
+#include <stdint.h>
+
+/* The sum of the 16-bit words equals the sum of the 32-bit words folded
+ * to 16 bits, so the loops add 32-bit words into a 64-bit accumulator
+ * and fold once at the end: no carry handling per word. The SSE2 loops
+ * do the same in two 64-bit lanes, 16 bytes per step, for buffers of
+ * SIMD_MIN bytes or more; the x87/SSE state is borrowed around them. */
+#define SIMD_MIN 256
+
+typedef u32 __attribute__((may_alias, aligned(1))) uword_t;
+typedef u16 __attribute__((may_alias, aligned(1))) uhalf_t;
+
+static int csum_simd = 0;
+
+int csum_set_simd(int enable){
+    csum_simd = enable != 0;
+    return csum_simd;
+}
+
+static inline u32 fold64(u64 s){
+    s = (s & 0xFFFFFFFFu) + (s >> 32);
+    s = (s & 0xFFFFFFFFu) + (s >> 32);
+    return (u32)s;
+}
+
+u16 csum_fold(u32 sum){
+    sum = (sum & 0xFFFF) + (sum >> 16);
+    sum = (sum & 0xFFFF) + (sum >> 16);
+    return (u16)~sum;
+}
+
+// the last 0..3 bytes; a lone byte is the first (low) byte of its word
+static u64 tail(const u8 *p, int len, u64 acc){
+    if(len & 2){ acc += *(const uhalf_t*)p; p += 2; }
+    if(len & 1) acc += *p;
+    return acc;
+}
+
+#define SSE2 __attribute__((target("sse2")))
+
+// 16-byte blocks of p added into acc; copied to d too unless d is NULL
+SSE2 static u64 sum_sse2(u8 *d, const u8 *p, int blocks, u64 acc){
+    u64 lanes[2];
+    kernel_fpu_begin();
+    if(d)
+        asm volatile("pxor %%xmm4, %%xmm4\n pxor %%xmm5, %%xmm5\n pxor %%xmm6, %%xmm6\n"
+                     "1: movdqu (%1), %%xmm0\n movdqu %%xmm0, (%0)\n movdqa %%xmm0, %%xmm1\n"
+                     "punpckldq %%xmm4, %%xmm0\n punpckhdq %%xmm4, %%xmm1\n paddq %%xmm0, %%xmm5\n paddq %%xmm1, %%xmm6\n"
+                     "add $16, %0\n add $16, %1\n dec %2\n jnz 1b\n"
+                     "paddq %%xmm6, %%xmm5\n movdqu %%xmm5, %3"
+                     : "+r"(d), "+r"(p), "+r"(blocks), "=m"(lanes)
+                     : : "memory", "cc", "xmm0", "xmm1", "xmm4", "xmm5", "xmm6");
+    else
+        asm volatile("pxor %%xmm4, %%xmm4\n pxor %%xmm5, %%xmm5\n pxor %%xmm6, %%xmm6\n"
+                     "1: movdqu (%0), %%xmm0\n movdqa %%xmm0, %%xmm1\n"
+                     "punpckldq %%xmm4, %%xmm0\n punpckhdq %%xmm4, %%xmm1\n paddq %%xmm0, %%xmm5\n paddq %%xmm1, %%xmm6\n"
+                     "add $16, %0\n dec %1\n jnz 1b\n"
+                     "paddq %%xmm6, %%xmm5\n movdqu %%xmm5, %2"
+                     : "+r"(p), "+r"(blocks), "=m"(lanes)
+                     : "m"(*(const u8(*)[])p) : "cc", "xmm0", "xmm1", "xmm4", "xmm5", "xmm6");
+    kernel_fpu_end();
+    return acc + lanes[0] + lanes[1];
+}
+
+u32 csum_partial(const void *buf, int len, u32 sum){
+    const u8 *p = buf;
+    u64 acc = sum;
+    if(csum_simd && len >= SIMD_MIN){
+        acc = sum_sse2(0, p, len >> 4, acc);
+        p += len & ~15;
+        len &= 15;
+    }
+    for(; len >= 16; len -= 16, p += 16)
+        acc += (u64)((const uword_t*)p)[0] + ((const uword_t*)p)[1]
+             + (u64)((const uword_t*)p)[2] + ((const uword_t*)p)[3];
+    for(; len >= 4; len -= 4, p += 4) acc += *(const uword_t*)p;
+    return fold64(tail(p, len, acc));
+}
+
+u32 csum_and_copy(void *dst, const void *src, int len, u32 sum){
+    u8 *d = dst;
+    const u8 *s = src;
+    u64 acc = sum;
+    if(csum_simd && len >= SIMD_MIN){
+        acc = sum_sse2(d, s, len >> 4, acc);
+        d += len & ~15; s += len & ~15;
+        len &= 15;
+    }
+    for(; len >= 4; len -= 4, d += 4, s += 4){
+        u32 v = *(const uword_t*)s;
+        *(uword_t*)d = v;
+        acc += v;
+    }
+    for(int i=0;i<len;i++) d[i] = s[i];
+    return fold64(tail(s, len, acc));
+}
+
+// pseudo header: src, dst, zero, proto, length, all in network order
+u32 csum_pseudo(u32 src_ip, u32 dst_ip, u8 proto, u16 len, u32 sum){
+    u64 acc = (u64)sum + __builtin_bswap32(src_ip) + __builtin_bswap32(dst_ip)
+            + ((u32)proto << 8) + __builtin_bswap16(len);
+    return fold64(acc);
+}
+
+// HC' = ~(~HC + ~m + m'), eqn. 3 of RFC 1624
+u16 csum_replace2(u16 check, u16 old, u16 new){
+    return csum_fold((u32)(u16)~check + (u16)~old + new);
+}
+
+u16 csum_replace4(u16 check, u32 old, u32 new){
+    return csum_fold(fold64((u64)(u16)~check + (u32)~old + new));
+}
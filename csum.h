@@ -0,0 +1,23 @@
+#ifndef CSUM_H
+#define CSUM_H
+
+#include "common.h"
+
+// Internet checksum (RFC 1071). Partial sums are 32-bit one's complement
+// accumulators over the data as it lies in memory (network order): add
+// pieces with csum_partial/csum_and_copy, each starting at an even offset
+// of the checksummed data, then csum_fold() gives the header field value,
+// stored as is.
+u32 csum_partial(const void *buf, int len, u32 sum);
+u32 csum_and_copy(void *dst, const void *src, int len, u32 sum);   // one pass
+u32 csum_pseudo(u32 src_ip, u32 dst_ip, u8 proto, u16 len, u32 sum); // TCP/UDP pseudo header, host order
+u16 csum_fold(u32 sum);
+
+// RFC 1624 incremental update: the checksum field after a 16/32-bit header
+// field changed from old to new (all values as stored in the header)
+u16 csum_replace2(u16 check, u16 old, u16 new);
+u16 csum_replace4(u16 check, u32 old, u32 new);
+
+int csum_set_simd(int enable);      // SSE2 loops for long buffers; caller checks support
+
+#endif
@@ -0,0 +1,89 @@
+// dma.c — page-backed DMA buffers and fixed-size DMA pools
+#include "dma.h"
+#include "pmm.h"
+#include "heap.h"
+#include "string.h"
+
+struct dma_pool {
+    const char *name;
+    u32 size, stride, boundary;
+    void *free;             // free buffers, linked through their first word
+    u32 pages, in_use;
+};
+
+static u32 pow2_at_least(u32 n){
+    u32 p = 1;
+    while(p < n) p <<= 1;
+    return p;
+}
+
+void *dma_alloc(u32 size, u32 align, u32 boundary, u32 *phys){
+    if(!size || (boundary && size > boundary)) return 0;
+    // a block no larger than a power of two A and aligned to A cannot
+    // cross a boundary that is a multiple of A
+    u32 a = align > PAGE_SIZE ? align : PAGE_SIZE;
+    if(boundary){
+        u32 nat = pow2_at_least(size);
+        if(nat > a) a = nat;
+    }
+    u32 frames = (size + PAGE_SIZE - 1)/PAGE_SIZE;
+    u32 p = pmm_alloc_contig(frames, a);
+    if(!p) return 0;
+    memset((void*)(uintptr_t)p, 0, frames*PAGE_SIZE);
+    if(phys) *phys = p;
+    return (void*)(uintptr_t)p;
+}
+
+void dma_free(void *p, u32 size){
+    if(p) pmm_free_contig(dma_phys(p), (size + PAGE_SIZE - 1)/PAGE_SIZE);
+}
+
+dma_pool_t *dma_pool_create(const char *name, u32 size, u32 align, u32 boundary){
+    if(!size || size > PAGE_SIZE) return 0;
+    if(!align) align = pow2_at_least(size);
+    if(align > PAGE_SIZE || (align & (align - 1))) return 0;
+    if(boundary && boundary < size) return 0;
+    dma_pool_t *pool = kcalloc(1, sizeof(*pool));
+    if(!pool) return 0;
+    u32 unit = align > DMA_CACHE_LINE ? align : DMA_CACHE_LINE;
+    pool->name = name;
+    pool->size = size;
+    pool->stride = (size + unit - 1) & ~(unit - 1);
+    pool->boundary = boundary;
+    return pool;
+}
+
+// cut a fresh page into buffers; pages are aligned, so only boundaries
+// smaller than a page need skipping
+static int pool_grow(dma_pool_t *pool){
+    u8 *pg = (u8*)(uintptr_t)pmm_alloc();
+    if(!pg) return -1;
+    pool->pages++;
+    u32 b = pool->boundary;
+    for(u32 off = 0; off + pool->stride <= PAGE_SIZE; off += pool->stride){
+        if(b && b < PAGE_SIZE && off/b != (off + pool->size - 1)/b){
+            off = (off + b - 1)/b*b - pool->stride;   // restart at the boundary
+            continue;
+        }
+        *(void**)(pg + off) = pool->free;
+        pool->free = pg + off;
+    }
+    return 0;
+}
+
+void *dma_pool_alloc(dma_pool_t *pool, u32 *phys){
+    if(!pool->free && pool_grow(pool) != 0) return 0;
+    void *p = pool->free;
+    pool->free = *(void**)p;
+    pool->in_use++;
+    memset(p, 0, pool->size);
+    if(phys) *phys = dma_phys(p);
+    return p;
+}
+
+void dma_pool_free(dma_pool_t *pool, void *p){
+    if(!p) return;
+    *(void**)p = pool->free;
+    pool->free = p;
+    pool->in_use--;
+}
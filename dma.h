@@ -0,0 +1,28 @@
+#ifndef DMA_H
+#define DMA_H
+
+#include <stdint.h>
+#include "common.h"
+
+#define DMA_CACHE_LINE 64
+
+// Memory for bus-master devices. Every buffer is physically contiguous,
+// aligned to `align` (0: naturally, i.e. to its size rounded up to a power
+// of two, at most a page), padded to whole cache lines, zeroed, and never
+// crosses a multiple of `boundary` (0: no limit). The physical address is
+// returned with the buffer; it equals the virtual one under the identity map.
+
+// Whole pages from the frame allocator, for rings and controller structures.
+void *dma_alloc(u32 size, u32 align, u32 boundary, u32 *phys);
+void  dma_free(void *p, u32 size);
+
+// Fixed-size buffers (at most a page) carved out of pages and reused, for
+// per-transfer buffers. Pools are never destroyed.
+typedef struct dma_pool dma_pool_t;
+dma_pool_t *dma_pool_create(const char *name, u32 size, u32 align, u32 boundary);
+void *dma_pool_alloc(dma_pool_t *pool, u32 *phys);
+void  dma_pool_free(dma_pool_t *pool, void *p);
+
+static inline u32 dma_phys(const void *v){ return (u32)(uintptr_t)v; }
+
+#endif
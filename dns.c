@@ -5,8 +5,10 @@
 #include "util_net.h"
 #include <stdint.h>
 #include "rtl8139.h"
+#include "ktime.h"
 
 #define DNS_CACHE_ENTRIES 8
+#define DNS_TIMEOUT_MS    2000
 struct dns_cache_entry { char name[128]; uint32_t ip; };
 static struct dns_cache_entry dns_cache[DNS_CACHE_ENTRIES];
 
@@ -135,8 +137,9 @@ int dns_resolve(const char *name, uint32_t *out_ip){
     if (!name || !out_ip) return 0;
     if (dns_get_cached(name, out_ip)) return 1;
     dns_query_async(name);
-    // wait up to some polls
-    for (int i=0;i<20000;i++){
+    // wait for the answer
+    deadline_t end = ktime_deadline_ms(DNS_TIMEOUT_MS);
+    while (!ktime_expired(end)){
         rtl8139_poll();
         if (dns_get_cached(name, out_ip)) return 1;
     }
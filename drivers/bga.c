@@ -0,0 +1,86 @@
+#include "bga.h"
+#include "graphics.h"
+#include "io.h"
+#include <stdint.h>
+
+// Bochs VBE "dispi" interface (qemu -vga std, Bochs, VirtualBox).
+// The mode GRUB set up is re-programmed with a virtual height of two
+// screens; drawing goes to the hidden half and a single Y_OFFSET write
+// makes it visible.
+
+#define VBE_DISPI_IOPORT_INDEX  0x01CE
+#define VBE_DISPI_IOPORT_DATA   0x01CF
+
+#define VBE_DISPI_INDEX_ID          0x0
+#define VBE_DISPI_INDEX_XRES        0x1
+#define VBE_DISPI_INDEX_YRES        0x2
+#define VBE_DISPI_INDEX_BPP         0x3
+#define VBE_DISPI_INDEX_ENABLE      0x4
+#define VBE_DISPI_INDEX_VIRT_WIDTH  0x6
+#define VBE_DISPI_INDEX_VIRT_HEIGHT 0x7
+#define VBE_DISPI_INDEX_X_OFFSET    0x8
+#define VBE_DISPI_INDEX_Y_OFFSET    0x9
+
+#define VBE_DISPI_ID2           0xB0C2  // first version with virtual height / offsets
+#define VBE_DISPI_ID5           0xB0C5
+#define VBE_DISPI_ENABLED       0x01
+#define VBE_DISPI_LFB_ENABLED   0x40
+#define VBE_DISPI_NOCLEARMEM    0x80
+
+static int back_page = 1;       // page not currently scanned out
+
+static inline void bga_write(uint16_t idx, uint16_t val){
+    outw(VBE_DISPI_IOPORT_INDEX, idx);
+    outw(VBE_DISPI_IOPORT_DATA, val);
+}
+
+static inline uint16_t bga_read(uint16_t idx){
+    outw(VBE_DISPI_IOPORT_INDEX, idx);
+    return inw(VBE_DISPI_IOPORT_DATA);
+}
+
+static u32 bga_begin_frame(void){
+    return framebuffer_addr + (u32)back_page*framebuffer_height*framebuffer_pitch;
+}
+
+static void bga_end_frame(const gfx_rect_t *rects, int count){
+    (void)rects; (void)count;
+    bga_write(VBE_DISPI_INDEX_Y_OFFSET, (uint16_t)(back_page*framebuffer_height));
+    back_page ^= 1;
+}
+
+static const gfx_display_t bga_display = {
+    "bga", 2, bga_begin_frame, bga_end_frame
+};
+
+int bga_init(void){
+    if(!framebuffer_addr || framebuffer_bpp != 32) return -1;
+    uint16_t id = bga_read(VBE_DISPI_INDEX_ID);
+    if(id < VBE_DISPI_ID2 || id > VBE_DISPI_ID5) return -1;
+
+    // only take over the mode GRUB actually set through this interface
+    uint16_t xres = bga_read(VBE_DISPI_INDEX_XRES);
+    uint16_t yres = bga_read(VBE_DISPI_INDEX_YRES);
+    if(xres != framebuffer_width || yres != framebuffer_height) return -1;
+
+    bga_write(VBE_DISPI_INDEX_ENABLE, 0);
+    bga_write(VBE_DISPI_INDEX_XRES, xres);
+    bga_write(VBE_DISPI_INDEX_YRES, yres);
+    bga_write(VBE_DISPI_INDEX_BPP, 32);
+    bga_write(VBE_DISPI_INDEX_VIRT_WIDTH, xres);
+    bga_write(VBE_DISPI_INDEX_VIRT_HEIGHT, (uint16_t)(yres*2));
+    bga_write(VBE_DISPI_INDEX_ENABLE, VBE_DISPI_ENABLED | VBE_DISPI_LFB_ENABLED | VBE_DISPI_NOCLEARMEM);
+    bga_write(VBE_DISPI_INDEX_X_OFFSET, 0);
+    bga_write(VBE_DISPI_INDEX_Y_OFFSET, 0);
+
+    // the device clamps the virtual height to its video memory
+    if(bga_read(VBE_DISPI_INDEX_VIRT_HEIGHT) < yres*2) {
+        bga_write(VBE_DISPI_INDEX_VIRT_HEIGHT, yres);
+        return -1;
+    }
+
+    framebuffer_pitch = (u32)xres*4;
+    back_page = 1;
+    gfx_set_display(&bga_display);
+    return 0;
+}
@@ -0,0 +1,6 @@
+#pragma once
+#include <stdint.h>
+
+// Bochs/QEMU dispi (BGA) display: double buffering by Y-offset page flips.
+// Returns 0 and installs itself as the gfx display backend on success.
+int bga_init(void);
@@ -3,6 +3,7 @@
 #include "io.h"
 #include "net.h"
 #include "string.h"
+#include "dma.h"
 #include <stdint.h>
 #include <stddef.h>
 
@@ -69,8 +70,9 @@ static uint8_t *tx_bufs[TX_DESC_COUNT];
 static uint32_t tx_tail = 0;
 static uint32_t tx_head = 0;
 
-// kmalloc provided by kernel
-extern void *kmalloc(size_t sz);
+// descriptor rings must be 128-byte aligned; buffers come from one pool
+#define E1000_RING_ALIGN 128
+static dma_pool_t *buf_pool = NULL;
 
 // helper to read/write mmio registers
 static inline uint32_t e1000_readl(uint32_t off){ return *((volatile uint32_t*)(mmio + off)); }
@@ -112,30 +114,35 @@ int rtl8139_init(void){
     if(!mmio) return -1;
 
     // allocate RX ring
-    rx_ring = (struct e1000_rx_desc*)kmalloc(sizeof(struct e1000_rx_desc)*RX_DESC_COUNT);
+    uint32_t rx_ring_phys, tx_ring_phys, buf_phys;
+    if(!buf_pool) buf_pool = dma_pool_create("e1000", RX_BUF_SIZE, 0, 0);
+    if(!buf_pool) return -1;
+    rx_ring = dma_alloc(sizeof(struct e1000_rx_desc)*RX_DESC_COUNT, E1000_RING_ALIGN, 0, &rx_ring_phys);
     if(!rx_ring) return -1;
     for(int i=0;i<RX_DESC_COUNT;i++){
-        rx_bufs[i] = (uint8_t*)kmalloc(RX_BUF_SIZE);
-        rx_ring[i].buffer_addr = (uint64_t)(uintptr_t)rx_bufs[i];
+        rx_bufs[i] = dma_pool_alloc(buf_pool, &buf_phys);
+        if(!rx_bufs[i]) return -1;
+        rx_ring[i].buffer_addr = buf_phys;
         rx_ring[i].status = 0;
     }
     rx_tail = RX_DESC_COUNT - 1;
-    e1000_writel(E1000_RDBAL, (uint32_t)(uintptr_t)rx_ring);
+    e1000_writel(E1000_RDBAL, rx_ring_phys);
     e1000_writel(E1000_RDBAH, 0);
     e1000_writel(E1000_RDLEN, RX_DESC_COUNT * sizeof(struct e1000_rx_desc));
     e1000_writel(E1000_RDH, 0);
     e1000_writel(E1000_RDT, rx_tail);
 
     // allocate TX ring
-    tx_ring = (struct e1000_tx_desc*)kmalloc(sizeof(struct e1000_tx_desc)*TX_DESC_COUNT);
+    tx_ring = dma_alloc(sizeof(struct e1000_tx_desc)*TX_DESC_COUNT, E1000_RING_ALIGN, 0, &tx_ring_phys);
     if(!tx_ring) return -1;
     for(int i=0;i<TX_DESC_COUNT;i++){
-        tx_bufs[i] = (uint8_t*)kmalloc(TX_BUF_SIZE);
-        tx_ring[i].buffer_addr = (uint64_t)(uintptr_t)tx_bufs[i];
+        tx_bufs[i] = dma_pool_alloc(buf_pool, &buf_phys);
+        if(!tx_bufs[i]) return -1;
+        tx_ring[i].buffer_addr = buf_phys;
         tx_ring[i].status = 0;
     }
     tx_head = tx_tail = 0;
-    e1000_writel(E1000_TDBAL, (uint32_t)(uintptr_t)tx_ring);
+    e1000_writel(E1000_TDBAL, tx_ring_phys);
     e1000_writel(E1000_TDBAH, 0);
     e1000_writel(E1000_TDLEN, TX_DESC_COUNT * sizeof(struct e1000_tx_desc));
     e1000_writel(E1000_TDH, 0);
@@ -169,7 +176,7 @@ void nic_tx(const void *data, int len){
     // if status indicates busy, skip (very simple)
     // copy data into buffer
     memcpy(tx_bufs[next], data, len);
-    tx_ring[next].buffer_addr = (uint64_t)(uintptr_t)tx_bufs[next];
+    tx_ring[next].buffer_addr = dma_phys(tx_bufs[next]);
     tx_ring[next].length = (uint16_t)len;
     tx_ring[next].cmd = 0x1B; // RS|IFCS|EOP|RS? use conservative
     tx_ring[next].status = 0;
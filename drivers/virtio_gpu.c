@@ -0,0 +1,329 @@
+#include "virtio_gpu.h"
+#include "graphics.h"
+#include "pci.h"
+#include "stdio.h"
+#include <stdint.h>
+#include <stddef.h>
+#include "ktime.h"
+
+// Minimal virtio-gpu 2D driver (virtio 1.0 PCI transport, polling only).
+// One host resource backed by guest RAM is set as scanout 0. Every frame
+// gfx_flush() writes the damaged rects into the backing, and end_frame()
+// sends TRANSFER_TO_HOST_2D per rect plus one RESOURCE_FLUSH, so only the
+// changed pixels ever cross to the host.
+
+#define VIRTIO_VENDOR        0x1AF4
+#define VIRTIO_GPU_DEVICE    0x1050   // 0x1040 + device type 16
+
+// virtio PCI capability types
+#define VIRTIO_PCI_CAP_COMMON_CFG  1
+#define VIRTIO_PCI_CAP_NOTIFY_CFG  2
+
+// common config layout
+#define VCOM_DFSELECT    0x00
+#define VCOM_DF          0x04
+#define VCOM_GFSELECT    0x08
+#define VCOM_GF          0x0C
+#define VCOM_STATUS      0x14
+#define VCOM_Q_SELECT    0x16
+#define VCOM_Q_SIZE      0x18
+#define VCOM_Q_ENABLE    0x1C
+#define VCOM_Q_NOFF      0x1E
+#define VCOM_Q_DESCLO    0x20
+#define VCOM_Q_DESCHI    0x24
+#define VCOM_Q_AVAILLO   0x28
+#define VCOM_Q_AVAILHI   0x2C
+#define VCOM_Q_USEDLO    0x30
+#define VCOM_Q_USEDHI    0x34
+
+#define VIRTIO_STATUS_ACK         1
+#define VIRTIO_STATUS_DRIVER      2
+#define VIRTIO_STATUS_DRIVER_OK   4
+#define VIRTIO_STATUS_FEATURES_OK 8
+
+#define VIRTQ_DESC_F_NEXT   1
+#define VIRTQ_DESC_F_WRITE  2
+
+// virtio-gpu control commands / responses
+#define VIRTIO_GPU_CMD_GET_DISPLAY_INFO        0x0100
+#define VIRTIO_GPU_CMD_RESOURCE_CREATE_2D      0x0101
+#define VIRTIO_GPU_CMD_SET_SCANOUT             0x0103
+#define VIRTIO_GPU_CMD_RESOURCE_FLUSH          0x0104
+#define VIRTIO_GPU_CMD_TRANSFER_TO_HOST_2D     0x0105
+#define VIRTIO_GPU_CMD_RESOURCE_ATTACH_BACKING 0x0106
+#define VIRTIO_GPU_RESP_OK_NODATA              0x1100
+#define VIRTIO_GPU_RESP_OK_DISPLAY_INFO        0x1101
+
+#define VIRTIO_GPU_FORMAT_B8G8R8X8_UNORM 2    // little-endian XRGB8888, same as the back buffer
+#define VGPU_RESOURCE_ID 1
+
+#define VQ_SIZE  64                 // descriptors; two per command
+#define VQ_CMDS  (VQ_SIZE/2)
+
+#pragma pack(push,1)
+struct virtq_desc  { uint64_t addr; uint32_t len; uint16_t flags; uint16_t next; };
+struct virtq_avail { uint16_t flags; uint16_t idx; uint16_t ring[VQ_SIZE]; uint16_t used_event; };
+struct virtq_used_elem { uint32_t id; uint32_t len; };
+struct virtq_used  { uint16_t flags; uint16_t idx; struct virtq_used_elem ring[VQ_SIZE]; uint16_t avail_event; };
+
+struct vgpu_hdr  { uint32_t type, flags; uint64_t fence_id; uint32_t ctx_id, padding; };
+struct vgpu_rect { uint32_t x, y, width, height; };
+
+struct vgpu_display_info {
+    struct vgpu_hdr hdr;
+    struct { struct vgpu_rect r; uint32_t enabled, flags; } pmodes[16];
+};
+struct vgpu_create_2d    { struct vgpu_hdr hdr; uint32_t resource_id, format, width, height; };
+struct vgpu_attach       { struct vgpu_hdr hdr; uint32_t resource_id, nr_entries;
+                           uint64_t addr; uint32_t length, padding; };   // one mem entry
+struct vgpu_set_scanout  { struct vgpu_hdr hdr; struct vgpu_rect r; uint32_t scanout_id, resource_id; };
+struct vgpu_transfer_2d  { struct vgpu_hdr hdr; struct vgpu_rect r; uint64_t offset; uint32_t resource_id, padding; };
+struct vgpu_flush        { struct vgpu_hdr hdr; struct vgpu_rect r; uint32_t resource_id, padding; };
+#pragma pack(pop)
+
+// request slots: large enough for any command above
+union vgpu_req {
+    struct vgpu_hdr hdr;
+    struct vgpu_create_2d create;
+    struct vgpu_attach attach;
+    struct vgpu_set_scanout scanout;
+    struct vgpu_transfer_2d transfer;
+    struct vgpu_flush flush;
+};
+
+static struct virtq_desc  vq_desc[VQ_SIZE]  __attribute__((aligned(16)));
+static struct virtq_avail vq_avail          __attribute__((aligned(2)));
+static struct virtq_used  vq_used           __attribute__((aligned(4)));
+static union vgpu_req     vq_req[VQ_CMDS];
+static struct vgpu_hdr    vq_resp[VQ_CMDS];
+static struct vgpu_display_info vq_info;
+static uint16_t vq_last_used = 0;
+static int vq_pending = 0;
+static int vq_dead = 0;         // a kick timed out: the device may still own the slots
+
+static volatile uint8_t *common_cfg = NULL;
+static volatile uint16_t *notify_addr = NULL;
+static uint32_t *backing = NULL;
+static int vgpu_ready = 0;
+
+// kmalloc provided by kernel
+extern void *kmalloc(size_t sz);
+
+static inline uint8_t  com_r8 (uint32_t off){ return *(volatile uint8_t*)(common_cfg + off); }
+static inline uint16_t com_r16(uint32_t off){ return *(volatile uint16_t*)(common_cfg + off); }
+static inline uint32_t com_r32(uint32_t off){ return *(volatile uint32_t*)(common_cfg + off); }
+static inline void com_w8 (uint32_t off, uint8_t v) { *(volatile uint8_t*)(common_cfg + off) = v; }
+static inline void com_w16(uint32_t off, uint16_t v){ *(volatile uint16_t*)(common_cfg + off) = v; }
+static inline void com_w32(uint32_t off, uint32_t v){ *(volatile uint32_t*)(common_cfg + off) = v; }
+
+static uint32_t bar_address(uint8_t bus, uint8_t slot, uint8_t func, uint8_t bar){
+    uint32_t v = pci_config_read32(bus,slot,func,(uint8_t)(0x10 + bar*4));
+    return (v & 1) ? 0 : (v & ~0xFu);   // memory BARs only; 64-bit BARs must sit below 4 GiB
+}
+
+// walk the vendor capabilities for the common and notify config windows
+static int find_caps(uint8_t bus, uint8_t slot, uint8_t func){
+    uint32_t notify_mult = 0, notify_base = 0;
+    if(!(pci_config_read16(bus,slot,func,0x06) & 0x10)) return -1;
+    uint8_t ptr = pci_config_read8(bus,slot,func,0x34) & 0xFC;
+    while(ptr){
+        uint8_t id = pci_config_read8(bus,slot,func,ptr);
+        if(id == 0x09){
+            uint8_t type = pci_config_read8(bus,slot,func,(uint8_t)(ptr+3));
+            uint8_t bar  = pci_config_read8(bus,slot,func,(uint8_t)(ptr+4));
+            uint32_t off = pci_config_read32(bus,slot,func,(uint8_t)(ptr+8));
+            uint32_t base = bar < 6 ? bar_address(bus,slot,func,bar) : 0;
+            if(base && type == VIRTIO_PCI_CAP_COMMON_CFG)
+                common_cfg = (volatile uint8_t*)(uintptr_t)(base + off);
+            if(base && type == VIRTIO_PCI_CAP_NOTIFY_CFG){
+                notify_base = base + off;
+                notify_mult = pci_config_read32(bus,slot,func,(uint8_t)(ptr+16));
+            }
+        }
+        ptr = pci_config_read8(bus,slot,func,(uint8_t)(ptr+1)) & 0xFC;
+    }
+    if(!common_cfg || !notify_base) return -1;
+    com_w16(VCOM_Q_SELECT, 0);
+    notify_addr = (volatile uint16_t*)(uintptr_t)(notify_base + com_r16(VCOM_Q_NOFF)*notify_mult);
+    return 0;
+}
+
+/* ---- control queue: commands are queued, then kicked and waited on together ----
+ * A kick the device does not complete within a second leaves the queue
+ * dead: the commands in flight still own their slots and responses, so
+ * nothing is submitted after that and the device is given up on. */
+static int vq_kick_wait(void){
+    if(vq_dead) return -1;
+    if(!vq_pending) return 0;
+    asm volatile("" ::: "memory");
+    *notify_addr = 0;
+    uint16_t want = (uint16_t)(vq_last_used + vq_pending);
+    deadline_t end = ktime_deadline_ms(1000);
+    while(*(volatile uint16_t*)&vq_used.idx != want)
+        if(ktime_expired(end)){
+            printf("virtio-gpu: %d commands not completed, giving up on the device\n", vq_pending);
+            vq_dead = 1;
+            vgpu_ready = 0;
+            return -1;
+        }else asm volatile("pause");
+    vq_last_used = want;
+    vq_pending = 0;
+    return 0;
+}
+
+// queue one command (request copied into a slot); resp may be NULL for OK_NODATA.
+// Returns the slot, whose default response lands in vq_resp[slot], or -1
+// once the queue is dead.
+static int vq_queue(const void *req, uint32_t req_len, void *resp, uint32_t resp_len){
+    if(vq_pending == VQ_CMDS && vq_kick_wait() != 0) return -1;
+    if(vq_dead) return -1;
+    int slot = (vq_avail.idx) % VQ_CMDS;
+    const uint8_t *src = (const uint8_t*)req;
+    uint8_t *dst = (uint8_t*)&vq_req[slot];
+    for(uint32_t i=0;i<req_len;i++) dst[i] = src[i];
+    if(!resp){ resp = &vq_resp[slot]; resp_len = sizeof(vq_resp[slot]); }
+
+    int d = slot*2;
+    vq_desc[d].addr  = (uint64_t)(uintptr_t)&vq_req[slot];
+    vq_desc[d].len   = req_len;
+    vq_desc[d].flags = VIRTQ_DESC_F_NEXT;
+    vq_desc[d].next  = (uint16_t)(d+1);
+    vq_desc[d+1].addr  = (uint64_t)(uintptr_t)resp;
+    vq_desc[d+1].len   = resp_len;
+    vq_desc[d+1].flags = VIRTQ_DESC_F_WRITE;
+    vq_desc[d+1].next  = 0;
+
+    vq_avail.ring[vq_avail.idx % VQ_SIZE] = (uint16_t)d;
+    asm volatile("" ::: "memory");
+    vq_avail.idx++;
+    vq_pending++;
+    return slot;
+}
+
+static void hdr_init(struct vgpu_hdr *h, uint32_t type){
+    h->type = type; h->flags = 0; h->fence_id = 0; h->ctx_id = 0; h->padding = 0;
+}
+
+/* ---- gfx display backend ---- */
+static u32 vgpu_begin_frame(void){ return (u32)(uintptr_t)backing; }
+
+static void vgpu_end_frame(const gfx_rect_t *rects, int count){
+    if(!count || vq_dead) return;
+    gfx_rect_t bb = rects[0];
+    for(int i=0;i<count;i++){
+        const gfx_rect_t *r = &rects[i];
+        struct vgpu_transfer_2d t;
+        hdr_init(&t.hdr, VIRTIO_GPU_CMD_TRANSFER_TO_HOST_2D);
+        t.r.x = r->x0; t.r.y = r->y0;
+        t.r.width = r->x1 - r->x0; t.r.height = r->y1 - r->y0;
+        t.offset = (uint64_t)r->y0*framebuffer_pitch + (uint64_t)r->x0*4;
+        t.resource_id = VGPU_RESOURCE_ID;
+        t.padding = 0;
+        vq_queue(&t, sizeof(t), NULL, 0);
+        if(r->x0 < bb.x0) bb.x0 = r->x0;
+        if(r->y0 < bb.y0) bb.y0 = r->y0;
+        if(r->x1 > bb.x1) bb.x1 = r->x1;
+        if(r->y1 > bb.y1) bb.y1 = r->y1;
+    }
+    struct vgpu_flush f;
+    hdr_init(&f.hdr, VIRTIO_GPU_CMD_RESOURCE_FLUSH);
+    f.r.x = bb.x0; f.r.y = bb.y0;
+    f.r.width = bb.x1 - bb.x0; f.r.height = bb.y1 - bb.y0;
+    f.resource_id = VGPU_RESOURCE_ID;
+    f.padding = 0;
+    vq_queue(&f, sizeof(f), NULL, 0);
+    vq_kick_wait();
+}
+
+static const gfx_display_t vgpu_display = {
+    "virtio-gpu", 1, vgpu_begin_frame, vgpu_end_frame
+};
+
+int virtio_gpu_is_ready(void){ return vgpu_ready; }
+
+int virtio_gpu_init(void){
+    uint8_t bus, slot, func;
+    if(!pci_find_device(VIRTIO_VENDOR, VIRTIO_GPU_DEVICE, &bus, &slot, &func)) return -1;
+
+    uint32_t cmd = pci_config_read32(bus,slot,func,0x04);
+    pci_config_write32(bus,slot,func,0x04, cmd | 0x0006);   // Memory space + Bus Master
+    if(find_caps(bus,slot,func) != 0) return -1;
+
+    // reset, acknowledge, negotiate VIRTIO_F_VERSION_1 only
+    com_w8(VCOM_STATUS, 0);
+    com_w8(VCOM_STATUS, VIRTIO_STATUS_ACK | VIRTIO_STATUS_DRIVER);
+    com_w32(VCOM_DFSELECT, 1);
+    if(!(com_r32(VCOM_DF) & 1)) return -1;
+    com_w32(VCOM_GFSELECT, 0); com_w32(VCOM_GF, 0);
+    com_w32(VCOM_GFSELECT, 1); com_w32(VCOM_GF, 1);
+    com_w8(VCOM_STATUS, VIRTIO_STATUS_ACK | VIRTIO_STATUS_DRIVER | VIRTIO_STATUS_FEATURES_OK);
+    if(!(com_r8(VCOM_STATUS) & VIRTIO_STATUS_FEATURES_OK)) return -1;
+
+    // control queue 0
+    com_w16(VCOM_Q_SELECT, 0);
+    if(com_r16(VCOM_Q_SIZE) < VQ_SIZE) return -1;
+    com_w16(VCOM_Q_SIZE, VQ_SIZE);
+    com_w32(VCOM_Q_DESCLO,  (uint32_t)(uintptr_t)vq_desc);  com_w32(VCOM_Q_DESCHI, 0);
+    com_w32(VCOM_Q_AVAILLO, (uint32_t)(uintptr_t)&vq_avail); com_w32(VCOM_Q_AVAILHI, 0);
+    com_w32(VCOM_Q_USEDLO,  (uint32_t)(uintptr_t)&vq_used);  com_w32(VCOM_Q_USEDHI, 0);
+    com_w16(VCOM_Q_ENABLE, 1);
+    com_w8(VCOM_STATUS, VIRTIO_STATUS_ACK | VIRTIO_STATUS_DRIVER |
+                        VIRTIO_STATUS_FEATURES_OK | VIRTIO_STATUS_DRIVER_OK);
+
+    // keep the multiboot mode if there is one, else take the host's preferred mode
+    u32 w = framebuffer_width, h = framebuffer_height;
+    if(!framebuffer_addr){
+        struct vgpu_hdr q;
+        hdr_init(&q, VIRTIO_GPU_CMD_GET_DISPLAY_INFO);
+        vq_queue(&q, sizeof(q), &vq_info, sizeof(vq_info));
+        if(vq_kick_wait() != 0) return -1;
+        if(vq_info.hdr.type != VIRTIO_GPU_RESP_OK_DISPLAY_INFO || !vq_info.pmodes[0].enabled) return -1;
+        w = vq_info.pmodes[0].r.width;
+        h = vq_info.pmodes[0].r.height;
+    }
+
+    backing = (uint32_t*)kmalloc(w*h*4);
+    if(!backing) return -1;
+
+    struct vgpu_create_2d c;
+    hdr_init(&c.hdr, VIRTIO_GPU_CMD_RESOURCE_CREATE_2D);
+    c.resource_id = VGPU_RESOURCE_ID;
+    c.format = VIRTIO_GPU_FORMAT_B8G8R8X8_UNORM;
+    c.width = w; c.height = h;
+    int setup[3];
+    setup[0] = vq_queue(&c, sizeof(c), NULL, 0);
+
+    struct vgpu_attach a;
+    hdr_init(&a.hdr, VIRTIO_GPU_CMD_RESOURCE_ATTACH_BACKING);
+    a.resource_id = VGPU_RESOURCE_ID;
+    a.nr_entries = 1;
+    a.addr = (uint64_t)(uintptr_t)backing;   // identity mapped, physically contiguous
+    a.length = w*h*4;
+    a.padding = 0;
+    setup[1] = vq_queue(&a, sizeof(a), NULL, 0);
+
+    struct vgpu_set_scanout so;
+    hdr_init(&so.hdr, VIRTIO_GPU_CMD_SET_SCANOUT);
+    so.r.x = 0; so.r.y = 0; so.r.width = w; so.r.height = h;
+    so.scanout_id = 0;
+    so.resource_id = VGPU_RESOURCE_ID;
+    setup[2] = vq_queue(&so, sizeof(so), NULL, 0);
+    if(vq_kick_wait() != 0) return -1;
+
+    for(int i=0;i<3;i++){
+        if(vq_resp[setup[i]].type != VIRTIO_GPU_RESP_OK_NODATA){
+            printf("virtio-gpu: setup command %d failed (%u)\n", i, vq_resp[setup[i]].type);
+            return -1;
+        }
+    }
+
+    if(!framebuffer_addr){
+        if(gfx_init_mode((u32)(uintptr_t)backing, w, h, w*4, 32) != 0) return -1;
+    }else{
+        framebuffer_pitch = w*4;    // the backing is tightly packed XRGB8888
+        gfx_set_format(32, 0);
+    }
+    vgpu_ready = 1;
+    gfx_set_display(&vgpu_display);
+    return 0;
+}
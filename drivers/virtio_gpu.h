@@ -0,0 +1,8 @@
+#pragma once
+#include <stdint.h>
+
+// virtio-gpu 2D scanout (QEMU -device virtio-gpu-pci / virtio-vga).
+// Installs itself as the gfx display backend; only damaged rects are
+// transferred to the host each frame. Returns 0 on success.
+int virtio_gpu_init(void);
+int virtio_gpu_is_ready(void);
@@ -1,5 +1,6 @@
 #pragma once
 #include <stdint.h>
+#include "csum.h"
 
 /* --- byte order helpers (freestanding, works on little-endian x86) --- */
 static inline uint16_t htons(uint16_t x) {
@@ -20,16 +21,5 @@ static inline uint32_t ntohl(uint32_t x) {
 
 /* --- IPv4 header checksum (no pseudo-header) --- */
 static inline uint16_t ip_checksum(const void *data, int len) {
-    const uint16_t *w = (const uint16_t*)data;
-    uint32_t sum = 0;
-
-    while (len > 1) {
-        sum += *w++;
-        len -= 2;
-    }
-    if (len == 1) sum += *(const uint8_t*)w;
-
-    while (sum >> 16) sum = (sum & 0xFFFF) + (sum >> 16);
-
-    return (uint16_t)~sum;
+    return csum_fold(csum_partial(data, len, 0));
 }
@@ -1,11 +1,13 @@
 #include "exec_elf.h"
 #include "string.h"
 #include "syscalls.h"
+#include "fpu.h"
 #include <stdint.h>
 #include <stddef.h>
 
-// Declare kmalloc provided by kmalloc_stub.c (don't include the .c to avoid duplicate symbol defs)
+// Declare kmalloc/kfree provided by heap.c
 void *kmalloc(size_t sz);
+void kfree(void *p);
 
 // Very small ELF32 loader: supports program headers PT_LOAD only.
 // Not robust; for demo only.
@@ -80,9 +82,20 @@ int elf32_load_and_run(const void *elf_data, size_t elf_size){
     // init syscalls
     init_syscalls();
 
+    // the program gets its own x87/SSE state, switched in lazily on its
+    // first FPU instruction and saved when kernel SIMD code borrows the
+    // registers
+    fpu_ctx_t *fpu = kmalloc(sizeof(fpu_ctx_t));
+    if(!fpu) return -5;
+    fpu->used = 0;
+    fpu_switch(fpu);
+
     // call entry and run until it returns or performs exit syscall
     int r = entry();
 
+    fpu_ctx_release(fpu);
+    kfree(fpu);
+
     // if program used exit syscall, return its code, else return entry return
     if(user_exited) return user_exit_code;
     return r;
@@ -2,7 +2,12 @@
 #define FONT_H
 
 #include "common.h"
+#include "graphics.h"
 
-extern const u8 font8x8_basic[128][8];
+extern const u8 font[256][8];   // built-in 8x8, MSB = leftmost pixel
+
+// Atlases generated from the built-in font by tools/mkfont (font_ui.c):
+// font_ui is the same 8x8 bitmap, font_ui_aa the 12px anti-aliased version.
+extern const gfx_font_t font_ui, font_ui_aa;
 
 #endif
@@ -0,0 +1,100 @@
+// fpu.c — x87/SSE enable and lazy per-context state switching
+#include "fpu.h"
+#include "cpu.h"
+#include "syscalls.h"
+
+/* CR0.TS makes the next x87/SSE instruction raise #NM. It is set whenever
+ * the registers do not hold the state of the current context (cur), and
+ * the #NM handler then saves the owner's state and restores cur's, so a
+ * context that never touches the FPU never pays for a switch. Kernel SIMD
+ * runs between kernel_fpu_begin/end on borrowed registers: the owner is
+ * saved and dropped, and cur gets its state back through the same trap. */
+#define CR0_MP (1u << 1)
+#define CR0_EM (1u << 2)
+#define CR0_TS (1u << 3)
+#define CR0_NE (1u << 5)
+#define CR4_OSFXSR     (1u << 9)
+#define CR4_OSXMMEXCPT (1u << 10)
+#define MXCSR_DEFAULT  0x1F80u      // all exceptions masked, round to nearest
+
+static int fxsr;                    // FXSAVE/FXRSTOR and SSE enabled
+static int ts;                      // mirror of CR0.TS
+static fpu_ctx_t *cur;              // context running now (NULL: kernel only)
+static fpu_ctx_t *owner;            // context whose state is in the registers
+static int depth;
+static u32 irq_flags;
+
+extern void nm_stub(void);          // irqstubs.S
+
+static inline void clts(void){ if(ts){ asm volatile("clts"); ts = 0; } }
+static inline void stts(void){ if(!ts){ write_cr0(read_cr0() | CR0_TS); ts = 1; } }
+
+static void save(fpu_ctx_t *c){
+    if(fxsr) asm volatile("fxsave %0" : "=m"(c->fx));
+    else     asm volatile("fnsave %0; fwait" : "=m"(c->fx));
+    c->used = 1;
+}
+
+static void restore(fpu_ctx_t *c){
+    if(!c->used){
+        u32 mxcsr = MXCSR_DEFAULT;
+        asm volatile("fninit");
+        if(fxsr) asm volatile("ldmxcsr %0" : : "m"(mxcsr));
+    }else if(fxsr) asm volatile("fxrstor %0" : : "m"(c->fx));
+    else           asm volatile("frstor %0" : : "m"(c->fx));
+}
+
+// #NM: the current context wants its registers back
+void fpu_nm_handler_c(void){
+    clts();
+    if(owner == cur) return;
+    if(owner) save(owner);
+    if(cur) restore(cur);
+    owner = cur;
+}
+
+int fpu_init(void){
+    u32 d;
+    cpuid(1, 0, 0, 0, &d);
+    write_cr0((read_cr0() & ~(CR0_EM | CR0_TS)) | CR0_MP | CR0_NE);
+    if((d & (1u << 24)) && (d & (1u << 25))){     // FXSR, SSE
+        write_cr4(read_cr4() | CR4_OSFXSR | CR4_OSXMMEXCPT);
+        fxsr = 1;
+    }
+    ts = 0;
+    u32 mxcsr = MXCSR_DEFAULT;
+    asm volatile("fninit");
+    if(fxsr) asm volatile("ldmxcsr %0" : : "m"(mxcsr));
+    idt_set_gate(7, nm_stub);
+    return fxsr;
+}
+
+void fpu_switch(fpu_ctx_t *ctx){
+    cur = ctx;
+    if(owner == cur || !cur) clts();
+    else stts();
+}
+
+void fpu_ctx_release(fpu_ctx_t *ctx){
+    if(owner == ctx) owner = 0;
+    if(cur == ctx) fpu_switch(0);
+}
+
+// Interrupts go off before depth is looked at, so an interrupt handler
+// using SIMD never finds a depth the code it interrupted has bumped but not
+// yet acted on. Only the outermost pair saves and restores the flags; end
+// runs with interrupts still off, so its depth update is just as safe.
+void kernel_fpu_begin(void){
+    u32 flags = irq_save();
+    if(depth++) return;
+    irq_flags = flags;
+    clts();
+    if(owner){ save(owner); owner = 0; }
+}
+
+void kernel_fpu_end(void){
+    u32 flags = irq_flags;
+    if(--depth) return;
+    if(cur) stts();
+    irq_restore(flags);
+}
@@ -0,0 +1,31 @@
+#ifndef FPU_H
+#define FPU_H
+
+#include "common.h"
+
+// x87/SSE state of one execution context (a loaded user program), saved
+// and restored with FXSAVE/FXRSTOR.
+typedef struct {
+    u8  fx[512] __attribute__((aligned(16)));
+    int used;                   // fx holds a saved state (else: start clean)
+} fpu_ctx_t;
+
+// Enable the FPU and, when the CPU has FXSR and SSE, SSE state handling
+// (CR4.OSFXSR/OSXMMEXCPT), and install the #NM handler. Returns 1 if SSE
+// can be used. Call before anything checks cpu_sse2_usable().
+int  fpu_init(void);
+
+// Make ctx (NULL: none, kernel code only) the context that owns the
+// registers from now on. Its state is restored lazily, on its first
+// FPU/SSE instruction (CR0.TS trap).
+void fpu_switch(fpu_ctx_t *ctx);
+void fpu_ctx_release(fpu_ctx_t *ctx);   // before freeing a context
+
+// Kernel code that uses x87/SSE registers brackets the use with these; the
+// state of whichever context had the registers is saved first, and
+// interrupts stay off in between. They nest; nothing is kept from one
+// begin/end pair to the next.
+void kernel_fpu_begin(void);
+void kernel_fpu_end(void);
+
+#endif
@@ -0,0 +1,129 @@
+// gfx_blend.c — alpha blending and colour-key row kernels (scalar + SSE2)
+#include "gfx_blend.h"
+
+/* All kernels work on 8-bit channels widened to 16 bits and divide by 255
+ * with the exact rounding identity
+ *     x/255 = (t + (t >> 8)) >> 8,  t = x + 128     for x <= 255*255
+ * so a product and its rounding fit one 16-bit lane. Sums saturate at 255
+ * (packuswb in the SIMD path), which only matters for sources that are not
+ * valid premultiplied colours. */
+static inline u32 div255(u32 x){ x += 128; return (x + (x >> 8)) >> 8; }
+static inline u32 sat8(u32 x){ return x > 255 ? 255 : x; }
+
+static inline u32 over_px(u32 p, u32 q){
+    u32 ia = 255 - (p >> 24);
+    return sat8((p >> 24)         + div255((q >> 24)*ia)) << 24 |
+           sat8(((p >> 16) & 0xFF) + div255(((q >> 16) & 0xFF)*ia)) << 16 |
+           sat8(((p >> 8) & 0xFF)  + div255(((q >> 8) & 0xFF)*ia)) << 8 |
+           sat8((p & 0xFF)         + div255((q & 0xFF)*ia));
+}
+
+static inline u32 mix_px(u32 p, u32 q, u32 a){
+    u32 ia = 255 - a;
+    return div255((p >> 24)*a + (q >> 24)*ia) << 24 |
+           div255(((p >> 16) & 0xFF)*a + ((q >> 16) & 0xFF)*ia) << 16 |
+           div255(((p >> 8) & 0xFF)*a + ((q >> 8) & 0xFF)*ia) << 8 |
+           div255((p & 0xFF)*a + (q & 0xFF)*ia);
+}
+
+static void over_scalar(u32 *d, const u32 *s, int n){
+    for(int i=0;i<n;i++){
+        u32 p = s[i];
+        if((p >> 24) == 255) d[i] = p;          // opaque
+        else if(p) d[i] = over_px(p, d[i]);     // fully clear (0) leaves d
+    }
+}
+
+static void over_fill_scalar(u32 *d, u32 c, int n){
+    for(int i=0;i<n;i++) d[i] = over_px(c, d[i]);
+}
+
+static void mix_scalar(u32 *d, const u32 *s, int n, u32 a){
+    for(int i=0;i<n;i++) d[i] = mix_px(s[i], d[i], a);
+}
+
+static void keyed_scalar(u32 *d, const u32 *s, int n, u32 key){
+    for(int i=0;i<n;i++) if(s[i] != key) d[i] = s[i];
+}
+
+const gfx_blend_ops_t gfx_blend_scalar = {
+    "scalar", over_scalar, over_fill_scalar, mix_scalar, keyed_scalar
+};
+
+/* SSE2: four pixels per step, unpacked to two registers of 8 x u16. Only
+ * these functions are compiled for SSE2, so the rest of the kernel stays
+ * x87/integer-only; callers pick this table only when the CPU has SSE2
+ * and the OS has enabled it, and call it between kernel_fpu_begin/end.
+ * Tails go through the scalar loops. */
+typedef char           v16qi __attribute__((vector_size(16)));
+typedef short          v8hi  __attribute__((vector_size(16)));
+typedef unsigned short v8hu  __attribute__((vector_size(16)));
+typedef int            v4si  __attribute__((vector_size(16)));
+typedef int            v4si_u __attribute__((vector_size(16), aligned(4)));   // unaligned access
+
+// The vector locals spill with aligned stores (the kernel is built without
+// -O), so each function realigns its own stack to 16 rather than trusting
+// its caller's alignment.
+#define SSE2 __attribute__((target("sse2"), force_align_arg_pointer))
+
+#define LO(x) ((v8hu)__builtin_ia32_punpcklbw128((v16qi)(x), (v16qi){0}))
+#define HI(x) ((v8hu)__builtin_ia32_punpckhbw128((v16qi)(x), (v16qi){0}))
+#define PACK(lo, hi) ((v4si)__builtin_ia32_packuswb128((v8hi)(lo), (v8hi)(hi)))
+#define DIV255(t) ({ v8hu t_ = (t) + 128; (t_ + (t_ >> 8)) >> 8; })
+#define ALPHAS(x) __builtin_shuffle((x), (v8hu){3,3,3,3,7,7,7,7})
+
+SSE2 static inline v4si over4(v4si sv, v4si dv){
+    v8hu slo = LO(sv), shi = HI(sv);
+    v8hu dlo = LO(dv), dhi = HI(dv);
+    v8hu rlo = slo + DIV255(dlo * (255 - ALPHAS(slo)));
+    v8hu rhi = shi + DIV255(dhi * (255 - ALPHAS(shi)));
+    return PACK(rlo, rhi);
+}
+
+SSE2 static void over_sse2(u32 *d, const u32 *s, int n){
+    int i = 0;
+    for(; i + 4 <= n; i += 4){
+        v4si_u *dp = (v4si_u*)(d + i);
+        *dp = over4(*(const v4si_u*)(s + i), *dp);
+    }
+    over_scalar(d + i, s + i, n - i);
+}
+
+SSE2 static void over_fill_sse2(u32 *d, u32 c, int n){
+    v4si cv = { (int)c, (int)c, (int)c, (int)c };
+    int i = 0;
+    for(; i + 4 <= n; i += 4){
+        v4si_u *dp = (v4si_u*)(d + i);
+        *dp = over4(cv, *dp);
+    }
+    over_fill_scalar(d + i, c, n - i);
+}
+
+SSE2 static void mix_sse2(u32 *d, const u32 *s, int n, u32 a){
+    v8hu av = (v8hu){0} + (unsigned short)a, iv = 255 - av;
+    int i = 0;
+    for(; i + 4 <= n; i += 4){
+        v4si_u *dp = (v4si_u*)(d + i);
+        v4si sv = *(const v4si_u*)(s + i), dv = *dp;
+        v8hu rlo = DIV255(LO(sv)*av + LO(dv)*iv);
+        v8hu rhi = DIV255(HI(sv)*av + HI(dv)*iv);
+        *dp = PACK(rlo, rhi);
+    }
+    mix_scalar(d + i, s + i, n - i, a);
+}
+
+SSE2 static void keyed_sse2(u32 *d, const u32 *s, int n, u32 key){
+    v4si kv = { (int)key, (int)key, (int)key, (int)key };
+    int i = 0;
+    for(; i + 4 <= n; i += 4){
+        v4si_u *dp = (v4si_u*)(d + i);
+        v4si sv = *(const v4si_u*)(s + i);
+        v4si m = sv == kv;
+        *dp = (*dp & m) | (sv & ~m);
+    }
+    keyed_scalar(d + i, s + i, n - i, key);
+}
+
+const gfx_blend_ops_t gfx_blend_sse2 = {
+    "sse2", over_sse2, over_fill_sse2, mix_sse2, keyed_sse2
+};
@@ -0,0 +1,19 @@
+#ifndef GFX_BLEND_H
+#define GFX_BLEND_H
+
+#include "common.h"
+
+/* Row kernels behind the blending blits (32-bit XRGB/ARGB pixels, n may be
+ * any length). Both sets give bit-identical results. */
+typedef struct {
+    const char *name;
+    void (*over)(u32 *d, const u32 *s, int n);            // premultiplied s over d
+    void (*over_fill)(u32 *d, u32 c, int n);              // premultiplied c over d
+    void (*mix)(u32 *d, const u32 *s, int n, u32 alpha);  // d = s*a + d*(1-a)
+    void (*keyed)(u32 *d, const u32 *s, int n, u32 key);  // copy s where s != key
+} gfx_blend_ops_t;
+
+extern const gfx_blend_ops_t gfx_blend_scalar;
+extern const gfx_blend_ops_t gfx_blend_sse2;
+
+#endif
@@ -1,9 +1,152 @@
 #include "graphics.h"
+#include "gfx_blend.h"
+#include "font.h"
 #include "multiboot.h"
+#include "fpu.h"
+#include <stddef.h>
+#include <stdint.h>
 
 u32 framebuffer_addr=0, framebuffer_width=0, framebuffer_height=0;
 u32 framebuffer_bpp=0, framebuffer_pitch=0;
 
+// kmalloc provided by kernel
+extern void *kmalloc(size_t sz);
+
+/* All drawing goes to a system-RAM back buffer (XRGB8888, stride = width).
+ * Touched areas are recorded in a small damage list and copied to the real
+ * framebuffer by gfx_flush(), so VRAM is only ever written sequentially and
+ * never read back. */
+static u32 *backbuf = 0;
+
+/* The primitives draw into the current target: the back buffer by default,
+ * or an off-screen surface picked with gfx_set_target(). Each call reports
+ * its extent to the target's damage hook once. */
+static void screen_damage(gfx_surface_t *s,int x,int y,int w,int h){ (void)s; gfx_damage(x,y,w,h); }
+static gfx_surface_t screen = { 0, 0, 0, screen_damage };
+static gfx_surface_t *tgt = &screen;
+
+static inline void mark(int x,int y,int w,int h){
+    if(tgt->damage) tgt->damage(tgt, x, y, w, h);
+}
+
+gfx_surface_t *gfx_set_target(gfx_surface_t *s){
+    gfx_surface_t *old = tgt == &screen ? 0 : tgt;
+    tgt = s ? s : &screen;
+    return old;
+}
+
+#define GFX_MAX_DAMAGE 32
+static gfx_rect_t damage[GFX_MAX_DAMAGE];
+static int damage_count = 0;
+
+/* Optional display backend. Without one, gfx_flush() writes straight into
+ * the multiboot framebuffer. A double-buffered backend (pages == 2) hands
+ * out the hidden page each frame; that page last received the damage of
+ * two frames ago, so the previous frame's rects are replayed into it too. */
+static const gfx_display_t *display = 0;
+static gfx_rect_t prev_damage[GFX_MAX_DAMAGE];
+static int prev_count = 0;
+
+/* Cursor overlay: never stored in the back buffer. gfx_flush() restores
+ * the old position from the back buffer and composites the arrow at the
+ * new one, so any number of moves between flushes costs one small copy. */
+#define CURSOR_W 8
+#define CURSOR_H 8
+static const u8 cursor_shape[CURSOR_H] = { 0x80,0xC0,0xE0,0xF0,0xF8,0xFC,0xFE,0xFF }; // left-top arrow
+static const u32 cursor_color = 0x000000;
+static int cursor_x = 0, cursor_y = 0, cursor_visible = 0;
+static int cursor_shown_x = 0, cursor_shown_y = 0, cursor_shown = 0;   // what the framebuffer holds
+
+/* 32-bit span kernels. rep stosl/movsl take the fast-string microcode path
+ * on anything newer than a Pentium Pro, which beats a C loop at -O0 by a
+ * wide margin and needs no FPU/SSE state. */
+static inline void span_fill(u32 *d, u32 c, int n){
+    if(n <= 0) return;
+    asm volatile("cld; rep stosl" : "+D"(d), "+c"(n) : "a"(c) : "memory");
+}
+static inline void span_copy(u32 *d, const u32 *s, int n){
+    if(n <= 0) return;
+    asm volatile("cld; rep movsl" : "+D"(d), "+S"(s), "+c"(n) : : "memory");
+}
+
+/* Scanout format kernels. The back buffer is always XRGB8888; only the
+ * store into the framebuffer depends on the mode, so one row converter per
+ * (bpp, channel order) is generated below and bound once at mode setup.
+ * Each inner loop is branch-free for its format. */
+#define PX_RGB(p)   (p)
+#define PX_BGR(p)   (((p) & 0xFF00FF00u) | (((p) >> 16) & 0xFF) | (((p) & 0xFF) << 16))
+#define PX_565(p)   (u16)((((p) >> 8) & 0xF800) | (((p) >> 5) & 0x07E0) | (((p) >> 3) & 0x001F))
+#define PX_555(p)   (u16)((((p) >> 9) & 0x7C00) | (((p) >> 6) & 0x03E0) | (((p) >> 3) & 0x001F))
+
+#define DEFINE_ROW16(name, ORDER, PACK) \
+static void name(u8 *d8, const u32 *s, int n){ \
+    u16 *d = (u16*)d8; \
+    for(int i=0;i<n;i++){ u32 p = ORDER(s[i]); d[i] = PACK(p); } \
+}
+#define DEFINE_ROW24(name, ORDER) \
+static void name(u8 *d, const u32 *s, int n){ \
+    for(int i=0;i<n;i++, d+=3){ u32 p = ORDER(s[i]); d[0]=(u8)p; d[1]=(u8)(p>>8); d[2]=(u8)(p>>16); } \
+}
+#define DEFINE_ROW32(name, ORDER) \
+static void name(u8 *d8, const u32 *s, int n){ \
+    u32 *d = (u32*)d8; \
+    for(int i=0;i<n;i++) d[i] = ORDER(s[i]); \
+}
+
+DEFINE_ROW16(row_rgb555, PX_RGB, PX_555)
+DEFINE_ROW16(row_bgr555, PX_BGR, PX_555)
+DEFINE_ROW16(row_rgb565, PX_RGB, PX_565)
+DEFINE_ROW16(row_bgr565, PX_BGR, PX_565)
+DEFINE_ROW24(row_rgb888, PX_RGB)
+DEFINE_ROW24(row_bgr888, PX_BGR)
+DEFINE_ROW32(row_xbgr8888, PX_BGR)
+static void row_xrgb8888(u8 *d, const u32 *s, int n){ span_copy((u32*)d, s, n); }
+
+typedef void (*row_fn)(u8 *dst, const u32 *src, int n);
+static row_fn scanout_row = row_xrgb8888;
+static int scanout_bytes = 4;    // bytes per framebuffer pixel
+
+// 15 is RGB555 in 16-bit pixels; any other depth is refused
+int gfx_set_format(u32 bpp, int bgr){
+    switch(bpp){
+        case 15: scanout_row = bgr ? row_bgr555 : row_rgb555; scanout_bytes = 2; break;
+        case 16: scanout_row = bgr ? row_bgr565 : row_rgb565; scanout_bytes = 2; break;
+        case 24: scanout_row = bgr ? row_bgr888 : row_rgb888; scanout_bytes = 3; break;
+        case 32: scanout_row = bgr ? row_xbgr8888 : row_xrgb8888; scanout_bytes = 4; break;
+        default: return -1;
+    }
+    framebuffer_bpp = bpp;
+    return 0;
+}
+
+// clip [x,x+w) x [y,y+h) to the target; returns 0 when nothing is left
+static inline int clip_rect(int *x,int *y,int *w,int *h){
+    if(*x < 0){ *w += *x; *x = 0; }
+    if(*y < 0){ *h += *y; *y = 0; }
+    if(*x + *w > tgt->width)  *w = tgt->width  - *x;
+    if(*y + *h > tgt->height) *h = tgt->height - *y;
+    return *w > 0 && *h > 0;
+}
+
+static void build_glyph_masks(void);
+
+/* The multiboot mode as a gfx_set_format() depth and channel order: only
+ * direct colour with 8:8:8, 5:6:5 or 5:5:5 channels packed from bit 0,
+ * red either on top (RGB) or at the bottom (BGR). */
+static int fb_format(const multiboot_tag_framebuffer_t *fb, u32 *bpp, int *bgr){
+    u32 r = fb->red_mask_size, g = fb->green_mask_size, b = fb->blue_mask_size;
+    if(fb->framebuffer_type != 1 || r != b || (g != r && g != r + 1)) return -1;
+    if(r == 8 && (fb->framebuffer_bpp == 24 || fb->framebuffer_bpp == 32)) *bpp = fb->framebuffer_bpp;
+    else if(r == 5 && fb->framebuffer_bpp == 16) *bpp = g == 6 ? 16 : 15;
+    else if(r == 5 && g == 5 && fb->framebuffer_bpp == 15) *bpp = 15;
+    else return -1;
+    if(fb->green_field_position != b) return -1;
+    if(fb->blue_field_position == 0 && fb->red_field_position == g + b) *bgr = 0;
+    else if(fb->red_field_position == 0 && fb->blue_field_position == g + r) *bgr = 1;
+    else return -1;
+    return 0;
+}
+
 void init_graphics(multiboot_info_t *m)
 {
     multiboot_tag_t *tag;
@@ -12,60 +155,585 @@ void init_graphics(multiboot_info_t *m)
     {
         if(tag->type == 8) {
             multiboot_tag_framebuffer_t *fb=(void*)tag;
-            framebuffer_addr   = fb->framebuffer_addr;
-            framebuffer_width  = fb->framebuffer_width;
-            framebuffer_height = fb->framebuffer_height;
-            framebuffer_bpp    = fb->framebuffer_bpp;
-            framebuffer_pitch  = fb->framebuffer_pitch;
+            u32 bpp; int bgr;
+            if(fb_format(fb, &bpp, &bgr) != 0) return;  // no scanout kernel: leave graphics off
+            if(gfx_init_mode(fb->framebuffer_addr, fb->framebuffer_width, fb->framebuffer_height,
+                             fb->framebuffer_pitch, bpp) != 0) return;
+            if(bgr) gfx_set_format(bpp, 1);
             return;
         }
     }
 }
 
+// set up the back buffer for a mode; also used by drivers that bring their own scanout
+int gfx_init_mode(u32 addr, u32 width, u32 height, u32 pitch, u32 bpp)
+{
+    if(gfx_set_format(bpp, 0) != 0) return -1;
+    framebuffer_addr   = addr;
+    framebuffer_width  = width;
+    framebuffer_height = height;
+    framebuffer_pitch  = pitch;
+
+    backbuf = (u32*)kmalloc(framebuffer_width*framebuffer_height*4);
+    if(!backbuf){ framebuffer_addr = 0; return -1; }
+    span_fill(backbuf, 0, (int)(framebuffer_width*framebuffer_height));
+    screen.pixels = backbuf;
+    screen.width  = (int)framebuffer_width;
+    screen.height = (int)framebuffer_height;
+    damage_count = 0;
+    build_glyph_masks();
+    return 0;
+}
+
+/* ------------------------------------------------------------
+Damage tracking
+----------------------------------------------------------*/
+static inline int rect_touches(const gfx_rect_t *a, const gfx_rect_t *b){
+    return a->x0 <= b->x1 && b->x0 <= a->x1 && a->y0 <= b->y1 && b->y0 <= a->y1;
+}
+
+static inline void rect_union(gfx_rect_t *a, const gfx_rect_t *b){
+    if(b->x0 < a->x0) a->x0 = b->x0;
+    if(b->y0 < a->y0) a->y0 = b->y0;
+    if(b->x1 > a->x1) a->x1 = b->x1;
+    if(b->y1 > a->y1) a->y1 = b->y1;
+}
+
+static inline int rect_area(const gfx_rect_t *r){ return (r->x1-r->x0)*(r->y1-r->y0); }
+
+void gfx_damage(int x,int y,int w,int h){
+    if(!backbuf) return;
+    gfx_rect_t r = { x, y, x+w, y+h };
+    if(r.x0 < 0) r.x0 = 0;
+    if(r.y0 < 0) r.y0 = 0;
+    if(r.x1 > (int)framebuffer_width)  r.x1 = (int)framebuffer_width;
+    if(r.y1 > (int)framebuffer_height) r.y1 = (int)framebuffer_height;
+    if(r.x0 >= r.x1 || r.y0 >= r.y1) return;
+
+    // keep the list disjoint: absorb every rect the new one overlaps or touches
+    for(int i=0;i<damage_count;){
+        if(rect_touches(&damage[i], &r)){
+            rect_union(&r, &damage[i]);
+            damage[i] = damage[--damage_count];
+            i = 0;
+        } else i++;
+    }
+
+    if(damage_count == GFX_MAX_DAMAGE){
+        // list full: grow whichever entry gets the least extra area
+        int best = 0, best_cost = 0x7FFFFFFF;
+        for(int i=0;i<damage_count;i++){
+            gfx_rect_t u = damage[i];
+            rect_union(&u, &r);
+            int cost = rect_area(&u) - rect_area(&damage[i]);
+            if(cost < best_cost){ best_cost = cost; best = i; }
+        }
+        rect_union(&r, &damage[best]);
+        damage[best] = damage[--damage_count];
+        gfx_damage(r.x0, r.y0, r.x1-r.x0, r.y1-r.y0);
+        return;
+    }
+    damage[damage_count++] = r;
+}
+
+static void cursor_composite(u8 *base);
+static inline int rect_overlaps(const gfx_rect_t *a, const gfx_rect_t *b){
+    return a->x0 < b->x1 && b->x0 < a->x1 && a->y0 < b->y1 && b->y0 < a->y1;
+}
+
+void gfx_set_display(const gfx_display_t *disp){
+    display = disp;
+    prev_count = 0;
+    gfx_damage(0, 0, (int)framebuffer_width, (int)framebuffer_height);
+}
+
+u32 gfx_vram_size(void){
+    return framebuffer_pitch*framebuffer_height*(display ? display->pages : 1);
+}
+
+void gfx_flush(void){
+    if(!framebuffer_addr || !backbuf) return;
+    int flipping = display && display->pages == 2;
+    gfx_rect_t cur = { cursor_x, cursor_y, cursor_x+CURSOR_W, cursor_y+CURSOR_H };
+    int moved = cursor_shown && (!cursor_visible || cursor_shown_x != cursor_x || cursor_shown_y != cursor_y);
+    if(moved) gfx_damage(cursor_shown_x, cursor_shown_y, CURSOR_W, CURSOR_H);
+    int need_cursor = cursor_visible && (moved || !cursor_shown);
+    for(int i=0;i<damage_count && cursor_visible && !need_cursor;i++)
+        if(rect_overlaps(&damage[i], &cur)) need_cursor = 1;
+    if(!damage_count && !need_cursor) return;
+    if(need_cursor) gfx_damage(cursor_x, cursor_y, CURSOR_W, CURSOR_H);
+
+    u8 *base = display ? (u8*)(uintptr_t)display->begin_frame() : (u8*)(uintptr_t)framebuffer_addr;
+    if(flipping){
+        gfx_rect_t mine[GFX_MAX_DAMAGE];
+        int mine_count = damage_count;
+        for(int i=0;i<mine_count;i++) mine[i] = damage[i];
+        for(int i=0;i<prev_count;i++)
+            gfx_damage(prev_damage[i].x0, prev_damage[i].y0,
+                       prev_damage[i].x1-prev_damage[i].x0, prev_damage[i].y1-prev_damage[i].y0);
+        for(int i=0;i<mine_count;i++) prev_damage[i] = mine[i];
+        prev_count = mine_count;
+    }
+
+    for(int i=0;i<damage_count;i++){
+        const gfx_rect_t *r = &damage[i];
+        int w = r->x1 - r->x0;
+        const u32 *src = backbuf + r->y0*framebuffer_width + r->x0;
+        u8 *dst = base + r->y0*framebuffer_pitch + r->x0*scanout_bytes;
+        if(w == (int)framebuffer_width && framebuffer_pitch == framebuffer_width*scanout_bytes){
+            // full-width band: rows are contiguous on both sides
+            scanout_row(dst, src, w*(r->y1 - r->y0));
+            continue;
+        }
+        for(int y=r->y0;y<r->y1;y++){
+            scanout_row(dst, src, w);
+            src += framebuffer_width;
+            dst += framebuffer_pitch;
+        }
+    }
+
+    // a flipped-in page may still hold the arrow it was shown with, so it
+    // always gets the cursor; the single-page path only when it was disturbed
+    if(cursor_visible && (need_cursor || flipping)) cursor_composite(base);
+    if(display) display->end_frame(damage, damage_count);
+    damage_count = 0;
+
+    cursor_shown = cursor_visible;
+    cursor_shown_x = cursor_x;
+    cursor_shown_y = cursor_y;
+}
+
+void gfx_cursor_move(int x,int y){
+    cursor_x = x;
+    cursor_y = y;
+    cursor_visible = 1;
+}
+
+void gfx_cursor_hide(void){ cursor_visible = 0; }
+
+/* ------------------------------------------------------------
+Primitives (all draw into the current target)
+----------------------------------------------------------*/
+// store without damage bookkeeping; callers damage their whole extent once
+static inline void plot(int x,int y,u32 c){
+    if(x<0 || y<0 || x >= tgt->width || y >= tgt->height) return;
+    tgt->pixels[ y*tgt->width + x ]=c;
+}
+
 void put_pixel(int x,int y,u32 c){
-    if(!framebuffer_addr)return;
-    if(x<0 || y<0 || x >= (int)framebuffer_width || y >= (int)framebuffer_height) return;
-    ((u32*)framebuffer_addr)[ y*(framebuffer_pitch/4) + x ]=c;
+    if(!tgt->pixels)return;
+    plot(x,y,c);
+    mark(x,y,1,1);
 }
 
 u32 get_pixel(int x,int y){
-    if(!framebuffer_addr)return 0;
-    if(x<0 || y<0 || x >= (int)framebuffer_width || y >= (int)framebuffer_height) return 0;
-    return ((u32*)framebuffer_addr)[ y*(framebuffer_pitch/4) + x ];
+    if(!tgt->pixels)return 0;
+    if(x<0 || y<0 || x >= tgt->width || y >= tgt->height) return 0;
+    return tgt->pixels[ y*tgt->width + x ];
 }
 
 void draw_rect(int x,int y,int w,int h,u32 c){
-    for(int i=y;i<y+h;i++)
-        for(int j=x;j<x+w;j++)
-            put_pixel(j,i,c);
+    if(!tgt->pixels || !clip_rect(&x,&y,&w,&h))return;
+    u32 *row = tgt->pixels + y*tgt->width + x;
+    if(w == tgt->width){
+        span_fill(row, c, w*h);
+    }else{
+        for(int i=0;i<h;i++, row += tgt->width)
+            span_fill(row, c, w);
+    }
+    mark(x,y,w,h);
 }
 
-void draw_char(int x,int y,char c,u32 color)
-{
-    extern const u8 font[256][8];
-    const u8 *glyph = font[(int)c];
+void gfx_fill_span(int x,int y,int w,u32 c){
+    int h = 1;
+    if(!tgt->pixels || !clip_rect(&x,&y,&w,&h))return;
+    span_fill(tgt->pixels + y*tgt->width + x, c, w);
+    mark(x,y,w,1);
+}
 
-    for(int i=0;i<8;i++){
-        for(int j=0;j<8;j++){
-            if((glyph[i] >> (7-j)) & 1){
-                put_pixel(x+j, y+i, color);
-            }
+void gfx_blit(int x,int y,int w,int h,const u32 *src,int src_stride){
+    int sx = x, sy = y;
+    if(!tgt->pixels || !src || !clip_rect(&x,&y,&w,&h))return;
+    src += (y-sy)*src_stride + (x-sx);
+    u32 *row = tgt->pixels + y*tgt->width + x;
+    for(int i=0;i<h;i++, row += tgt->width, src += src_stride)
+        span_copy(row, src, w);
+    mark(x,y,w,h);
+}
+
+// Move the rows of [x,x+w) x [y,y+h) by dy (negative = up) inside the
+// target. Source and destination overlap, so rows are copied away from the
+// direction of travel; the uncovered band is left for the caller to redraw.
+void gfx_scroll(int x,int y,int w,int h,int dy){
+    if(!tgt->pixels || !dy || !clip_rect(&x,&y,&w,&h)) return;
+    const int W = tgt->width;
+    int n = h - (dy < 0 ? -dy : dy);
+    if(n > 0){
+        if(dy < 0){
+            u32 *d = tgt->pixels + y*W + x;
+            for(int i=0;i<n;i++, d += W) span_copy(d, d - dy*W, w);
+        }else{
+            u32 *d = tgt->pixels + (y+h-1)*W + x;
+            for(int i=0;i<n;i++, d -= W) span_copy(d, d - dy*W, w);
         }
     }
+    mark(x,y,w,h);
+}
+
+/* ------------------------------------------------------------
+Blending blits: clipping happens here, the per-row work in the kernels of
+gfx_blend.c (scalar, or SSE2 once gfx_set_simd() enabled it).
+----------------------------------------------------------*/
+static const gfx_blend_ops_t *blend_ops = &gfx_blend_scalar;
+
+int gfx_set_simd(int enable){
+    blend_ops = enable ? &gfx_blend_sse2 : &gfx_blend_scalar;
+    return enable != 0;
+}
+
+const char *gfx_simd_name(void){ return blend_ops->name; }
+
+// the SSE2 kernels borrow the SSE registers for one whole blit
+static inline void simd_begin(void){ if(blend_ops != &gfx_blend_scalar) kernel_fpu_begin(); }
+static inline void simd_end(void){ if(blend_ops != &gfx_blend_scalar) kernel_fpu_end(); }
+
+void gfx_blit_surface(int x,int y,const gfx_surface_t *src,int sx,int sy,int w,int h,int mode,u32 arg){
+    if(!tgt->pixels || !src || !src->pixels) return;
+    // clip the source rect to the source, then the destination to the target
+    if(sx < 0){ x -= sx; w += sx; sx = 0; }
+    if(sy < 0){ y -= sy; h += sy; sy = 0; }
+    if(sx + w > src->width)  w = src->width  - sx;
+    if(sy + h > src->height) h = src->height - sy;
+    int dx = x, dy = y;
+    if(!clip_rect(&x,&y,&w,&h)) return;
+    const u32 *s = src->pixels + (sy + y - dy)*src->width + (sx + x - dx);
+    u32 *d = tgt->pixels + y*tgt->width + x;
+    simd_begin();
+    for(int i=0;i<h;i++, d += tgt->width, s += src->width){
+        switch(mode){
+            case GFX_BLIT_KEY:   blend_ops->keyed(d, s, w, arg); break;
+            case GFX_BLIT_ALPHA: blend_ops->over(d, s, w); break;
+            case GFX_BLIT_BLEND: blend_ops->mix(d, s, w, arg & 0xFF); break;
+            default:             span_copy(d, s, w); break;
+        }
+    }
+    simd_end();
+    mark(x,y,w,h);
+}
+
+void gfx_fill_blend(int x,int y,int w,int h,u32 argb){
+    if(!tgt->pixels || !clip_rect(&x,&y,&w,&h)) return;
+    u32 *d = tgt->pixels + y*tgt->width + x;
+    simd_begin();
+    for(int i=0;i<h;i++, d += tgt->width) blend_ops->over_fill(d, argb, w);
+    simd_end();
+    mark(x,y,w,h);
+}
+
+/* ------------------------------------------------------------
+Lines: Cohen-Sutherland clips each segment to the screen first, so the
+rasterizer below never bounds-checks. Horizontal lines are one span,
+vertical lines one strided column, the rest integer Bresenham.
+----------------------------------------------------------*/
+#define OC_LEFT   1
+#define OC_RIGHT  2
+#define OC_TOP    4
+#define OC_BOTTOM 8
+
+static inline int outcode(int x,int y,int W,int H){
+    int c = 0;
+    if(x < 0) c |= OC_LEFT; else if(x >= W) c |= OC_RIGHT;
+    if(y < 0) c |= OC_TOP;  else if(y >= H) c |= OC_BOTTOM;
+    return c;
+}
+
+// a/b rounded to nearest, so clipped endpoints stay on the ideal line
+static inline int div_round(int a,int b){
+    if(b < 0){ a = -a; b = -b; }
+    return a >= 0 ? (a + b/2)/b : -((-a + b/2)/b);
+}
+
+// clip (x0,y0)-(x1,y1) to the target; 0 if nothing is left.
+// coordinates are expected within +-32K so the products below fit an int
+static int clip_line(int *x0,int *y0,int *x1,int *y1){
+    const int W = tgt->width, H = tgt->height;
+    int c0 = outcode(*x0,*y0,W,H), c1 = outcode(*x1,*y1,W,H);
+    for(;;){
+        if(!(c0 | c1)) return 1;
+        if(c0 & c1) return 0;
+        int c = c0 ? c0 : c1, x, y;
+        int dx = *x1 - *x0, dy = *y1 - *y0;
+        if(c & OC_TOP)         { y = 0;   x = *x0 + div_round(dx*(0 - *y0), dy); }
+        else if(c & OC_BOTTOM) { y = H-1; x = *x0 + div_round(dx*(H-1 - *y0), dy); }
+        else if(c & OC_LEFT)   { x = 0;   y = *y0 + div_round(dy*(0 - *x0), dx); }
+        else                   { x = W-1; y = *y0 + div_round(dy*(W-1 - *x0), dx); }
+        if(c == c0){ *x0 = x; *y0 = y; c0 = outcode(x,y,W,H); }
+        else       { *x1 = x; *y1 = y; c1 = outcode(x,y,W,H); }
+    }
+}
+
+// rasterize an already clipped segment, endpoints inclusive, no damage
+static void line_raster(int x0,int y0,int x1,int y1,u32 c){
+    const int W = tgt->width;
+    if(y0 == y1){
+        if(x0 > x1){ int t = x0; x0 = x1; x1 = t; }
+        span_fill(tgt->pixels + y0*W + x0, c, x1 - x0 + 1);
+        return;
+    }
+    if(x0 == x1){
+        if(y0 > y1){ int t = y0; y0 = y1; y1 = t; }
+        u32 *p = tgt->pixels + y0*W + x0;
+        for(int n = y1 - y0 + 1; n > 0; n--, p += W) *p = c;
+        return;
+    }
+    int dx = x1 - x0, dy = y1 - y0;
+    int sx = dx < 0 ? -1 : 1, sy = dy < 0 ? -W : W;
+    if(dx < 0) dx = -dx;
+    if(dy < 0) dy = -dy;
+    u32 *p = tgt->pixels + y0*W + x0;
+    if(dx >= dy){
+        int err = 2*dy - dx;
+        for(int n = dx; n >= 0; n--, p += sx){
+            *p = c;
+            if(err > 0){ p += sy; err -= 2*dx; }
+            err += 2*dy;
+        }
+    }else{
+        int err = 2*dx - dy;
+        for(int n = dy; n >= 0; n--, p += sy){
+            *p = c;
+            if(err > 0){ p += sx; err -= 2*dy; }
+            err += 2*dx;
+        }
+    }
+}
+
+void draw_line(int x0,int y0,int x1,int y1,u32 c){
+    if(!tgt->pixels || !clip_line(&x0,&y0,&x1,&y1)) return;
+    line_raster(x0,y0,x1,y1,c);
+    int lx = x0 < x1 ? x0 : x1, ly = y0 < y1 ? y0 : y1;
+    mark(lx, ly, (x0 < x1 ? x1 - x0 : x0 - x1) + 1, (y0 < y1 ? y1 - y0 : y0 - y1) + 1);
+}
+
+// Connected segments pts[0]-pts[1]-...-pts[n-1]. The batch's bounding box
+// is tested once: fully on screen skips per-segment clipping, fully off
+// screen draws nothing, and the whole batch records a single damage rect.
+void gfx_polyline(const gfx_point_t *pts,int n,u32 c){
+    if(!tgt->pixels || !pts || n < 2) return;
+    const int W = tgt->width, H = tgt->height;
+    int bx0 = pts[0].x, by0 = pts[0].y, bx1 = bx0, by1 = by0;
+    for(int i=1;i<n;i++){
+        if(pts[i].x < bx0) bx0 = pts[i].x;
+        if(pts[i].x > bx1) bx1 = pts[i].x;
+        if(pts[i].y < by0) by0 = pts[i].y;
+        if(pts[i].y > by1) by1 = pts[i].y;
+    }
+    if(bx1 < 0 || by1 < 0 || bx0 >= W || by0 >= H) return;
+    int inside = bx0 >= 0 && by0 >= 0 && bx1 < W && by1 < H;
+    for(int i=1;i<n;i++){
+        int x0 = pts[i-1].x, y0 = pts[i-1].y, x1 = pts[i].x, y1 = pts[i].y;
+        if(!inside && !clip_line(&x0,&y0,&x1,&y1)) continue;
+        line_raster(x0,y0,x1,y1,c);
+    }
+    mark(bx0, by0, bx1 - bx0 + 1, by1 - by0 + 1);
+}
+
+/* ------------------------------------------------------------
+Rounded shapes: per-row corner insets are computed once per radius and
+cached, then every scanline is emitted as one non-overlapping span.
+----------------------------------------------------------*/
+#define GFX_MAX_RADIUS   64
+#define GFX_ROUND_CACHE  4
+static struct { int r; u8 inset[GFX_MAX_RADIUS]; } round_cache[GFX_ROUND_CACHE];
+static int round_cache_next = 0;
+
+// inset[t] = pixels cut from each side on row t (t < r) counted from the top
+static const u8 *corner_insets(int r){
+    for(int i=0;i<GFX_ROUND_CACHE;i++)
+        if(round_cache[i].r == r) return round_cache[i].inset;
+
+    int slot = round_cache_next;
+    round_cache_next = (round_cache_next + 1) % GFX_ROUND_CACHE;
+    round_cache[slot].r = r;
+    // sample at pixel centres: pixel (i,t) is inside when
+    // (2r-2i-1)^2 + (2r-2t-1)^2 <= (2r)^2; the inset only shrinks going down
+    int i = r;
+    for(int t=0;t<r;t++){
+        int b = 2*r - 2*t - 1;
+        while(i > 0 && (2*r-2*i+1)*(2*r-2*i+1) + b*b <= 4*r*r) i--;
+        round_cache[slot].inset[t] = (u8)i;
+    }
+    return round_cache[slot].inset;
+}
+
+void draw_rounded(int x,int y,int w,int h,int r,u32 c){
+    if(!tgt->pixels || w <= 0 || h <= 0) return;
+    if(r > w/2) r = w/2;
+    if(r > h/2) r = h/2;
+    if(r > GFX_MAX_RADIUS) r = GFX_MAX_RADIUS;
+    if(r <= 0){ draw_rect(x,y,w,h,c); return; }
+    const u8 *ins = corner_insets(r);
+
+    const int W = tgt->width, H = tgt->height;
+    int t0 = y < 0 ? -y : 0;
+    int t1 = y + h > H ? H - y : h;
+    u32 *row = tgt->pixels + (y+t0)*W;
+    for(int t=t0;t<t1;t++, row += W){
+        int in = t < r ? ins[t] : (t >= h-r ? ins[h-1-t] : 0);
+        int x0 = x + in, x1 = x + w - in;
+        if(x0 < 0) x0 = 0;
+        if(x1 > W) x1 = W;
+        span_fill(row + x0, c, x1 - x0);
+    }
+    mark(x,y,w,h);
+}
+
+void fill_circle(int cx,int cy,int r,u32 c){
+    draw_rounded(cx-r, cy-r, 2*r+1, 2*r+1, r, c);
+}
+
+/* ------------------------------------------------------------
+Text: the 8x8 font is expanded once into per-row store masks, so a glyph
+row is 8 branch-free masked stores no matter how many bits are lit.
+----------------------------------------------------------*/
+static u32 glyph_rowmask[256][8];   // [row bits][column] -> 0 or ~0
+
+static void build_glyph_masks(void){
+    for(int b=0;b<256;b++)
+        for(int j=0;j<8;j++)
+            glyph_rowmask[b][j] = ((b >> (7-j)) & 1) ? 0xFFFFFFFFu : 0;
+}
+
+static inline void glyph_row(u32 *d, const u32 *m, u32 c, int n){
+    for(int j=0;j<n;j++) d[j] = (d[j] & ~m[j]) | (c & m[j]);
+}
+
+// draw n characters starting at (x,y); the whole run is clipped up front
+static void draw_text(int x,int y,const u8 *s,int n,u32 color){
+    const int W = tgt->width, H = tgt->height;
+    if(!tgt->pixels || n <= 0 || x >= W || y >= H || x + 8*n <= 0 || y + 8 <= 0) return;
+
+    int r0 = y < 0 ? -y : 0;
+    int r1 = y + 8 > H ? H - y : 8;
+    int i0 = x < 0 ? (-x)/8 : 0;
+    int i1 = x + 8*n > W ? (W - x + 7)/8 : n;
+
+    u32 *row = tgt->pixels + (y+r0)*W;
+    for(int r=r0;r<r1;r++, row += W){
+        for(int i=i0;i<i1;i++){
+            int cx = x + i*8;
+            int j0 = cx < 0 ? -cx : 0;
+            int j1 = cx + 8 > W ? W - cx : 8;
+            glyph_row(row + cx + j0, glyph_rowmask[font[s[i]][r]] + j0, color, j1 - j0);
+        }
+    }
+    mark(x, y, 8*n, 8);
+}
+
+// write back buffer + arrow for the cursor cell straight to the framebuffer
+static void cursor_composite(u8 *base){
+    const int W = (int)framebuffer_width, H = (int)framebuffer_height;
+    u32 row[CURSOR_W];
+    if(cursor_x < 0 || cursor_y < 0) return;
+    int n = cursor_x + CURSOR_W > W ? W - cursor_x : CURSOR_W;
+    for(int j=0;j<CURSOR_H && cursor_y+j<H;j++){
+        int y = cursor_y + j;
+        const u32 *src = backbuf + y*W + cursor_x;
+        const u32 *m = glyph_rowmask[cursor_shape[j]];
+        for(int i=0;i<n;i++) row[i] = (src[i] & ~m[i]) | (cursor_color & m[i]);
+        scanout_row(base + y*framebuffer_pitch + cursor_x*scanout_bytes, row, n);
+    }
+}
+
+void draw_char(int x,int y,char c,u32 color)
+{
+    u8 ch = (u8)c;
+    draw_text(x, y, &ch, 1, color);
+}
+
+void draw_string_n(int x,int y,const char *s,int n,u32 color)
+{
+    draw_text(x, y, (const u8*)s, n, color);
 }
 
 void draw_string(int x,int y,const char*s,u32 color)
 {
-    for(int i=0;s[i];i++){
-        draw_char(x + i*8, y, s[i], color);
+    int n = 0;
+    while(s[n] && x + 8*n < tgt->width) n++;   // nothing past the right edge matters
+    draw_text(x, y, (const u8*)s, n, color);
+}
+
+/* ------------------------------------------------------------
+Loadable fonts (PSF2 modules, build-time atlases). Mono glyphs store the
+colour where a bit is set. Coverage glyphs blend through 16-entry tables
+built once per call, so a pixel costs one lookup and two multiplies
+(red/blue share one) with no division.
+----------------------------------------------------------*/
+int gfx_text_width(const gfx_font_t *f,const char *s){
+    int n = 0;
+    while(s[n]) n++;
+    return f ? n*f->width : 8*n;
+}
+
+void gfx_draw_text(const gfx_font_t *f,int x,int y,const char *s,u32 color){
+    if(!f){ draw_string(x,y,s,color); return; }
+    const int W = tgt->width, H = tgt->height, fw = f->width;
+    int n = 0;
+    while(s[n] && x + fw*n < W) n++;
+    if(!tgt->pixels || n <= 0 || y >= H || x + fw*n <= 0 || y + f->height <= 0) return;
+
+    const int unk = '?' < f->count ? '?' : 0;
+    int r0 = y < 0 ? -y : 0;
+    int r1 = y + f->height > H ? H - y : f->height;
+
+    // per coverage level k (alpha k*17): colour*alpha for red|blue and
+    // green, and the weight left for the destination
+    u32 crb[16], cg[16], ia[16];
+    if(f->bpp == 4)
+        for(u32 k=0;k<16;k++){
+            u32 a = k*17;
+            crb[k] = (color & 0xFF00FF)*a;
+            cg[k]  = ((color >> 8) & 0xFF)*a;
+            ia[k]  = 255 - a;
+        }
+
+    for(int i=0;i<n;i++){
+        int cx = x + i*fw;
+        if(cx + fw <= 0) continue;
+        int j0 = cx < 0 ? -cx : 0;
+        int j1 = cx + fw > W ? W - cx : fw;
+        u8 ch = (u8)s[i];
+        const u8 *g = f->data + (ch < f->count ? ch : unk)*f->glyph_bytes;
+        u32 *row = tgt->pixels + (y+r0)*W + cx;
+        for(int r=r0;r<r1;r++, row += W){
+            const u8 *bits = g + r*f->row_bytes;
+            if(f->bpp == 1){
+                for(int j=j0;j<j1;j++)
+                    if(bits[j >> 3] & (0x80 >> (j & 7))) row[j] = color;
+                continue;
+            }
+            for(int j=j0;j<j1;j++){
+                u32 k = (bits[j >> 1] >> ((j & 1) ? 0 : 4)) & 15;
+                if(!k) continue;
+                if(k == 15){ row[j] = color; continue; }
+                u32 q = row[j];
+                // div255 with exact rounding, red and blue in one register
+                u32 rb = (q & 0xFF00FF)*ia[k] + crb[k] + 0x800080;
+                u32 gg = ((q >> 8) & 0xFF)*ia[k] + cg[k] + 0x80;
+                rb = ((rb + ((rb >> 8) & 0xFF00FF)) >> 8) & 0xFF00FF;
+                gg = (gg + (gg >> 8)) >> 8;
+                row[j] = rb | gg << 8;
+            }
+        }
     }
+    mark(x, y, fw*n, f->height);
 }
 
 void xor_pixel(int x,int y,u32 color){
-    if(!framebuffer_addr)return;
-    if(x<0 || y<0 || x >= (int)framebuffer_width || y >= (int)framebuffer_height) return;
-    u32 *fb=(u32*)framebuffer_addr;
-    fb[y*(framebuffer_pitch/4) + x] ^= color;
+    if(!tgt->pixels)return;
+    if(x<0 || y<0 || x >= tgt->width || y >= tgt->height) return;
+    tgt->pixels[y*tgt->width + x] ^= color;
+    mark(x,y,1,1);
 }
 
 void xor_cursor(int x,int y){
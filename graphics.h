@@ -8,14 +8,86 @@ extern u32 framebuffer_addr;
 extern u32 framebuffer_width;
 extern u32 framebuffer_height;
 extern u32 framebuffer_bpp;
+extern u32 framebuffer_pitch;
+
+typedef struct { int x0, y0, x1, y1; } gfx_rect_t;   // half-open [x0,x1) x [y0,y1)
+typedef struct { int x, y; } gfx_point_t;
+
+// Off-screen drawing target (XRGB8888, stride = width). damage() is called
+// with the extent of every primitive drawn into it; may be NULL.
+typedef struct gfx_surface {
+    u32 *pixels;
+    int width, height;
+    void (*damage)(struct gfx_surface *s, int x, int y, int w, int h);
+} gfx_surface_t;
+
+// Bitmap font: glyph i starts at data + i*glyph_bytes, rows row_bytes apart.
+// bpp 1 is a mono bitmap (MSB = leftmost pixel); bpp 4 holds one 0..15
+// coverage value per pixel (high nibble first) for anti-aliased text.
+typedef struct {
+    int width, height, count;
+    int bpp;
+    int row_bytes, glyph_bytes;
+    const u8 *data;
+} gfx_font_t;
+
+// Display backend used by gfx_flush(). begin_frame() returns the address of
+// the page to write (pitch = framebuffer_pitch); end_frame() receives the
+// rects written this frame and makes them visible.
+typedef struct {
+    const char *name;
+    int pages;                  // 1 = single page, 2 = flip between two pages
+    u32  (*begin_frame)(void);
+    void (*end_frame)(const gfx_rect_t *rects, int count);
+} gfx_display_t;
 
 void init_graphics(multiboot_info_t* mbd);
+int  gfx_init_mode(u32 addr, u32 width, u32 height, u32 pitch, u32 bpp);
+int  gfx_set_format(u32 bpp, int bgr);   // framebuffer pixel layout (15/16/24/32 bpp, RGB or BGR); -1 if unsupported
+// Primitives draw into the current target; NULL selects the screen back
+// buffer. Returns the previous target (NULL for the screen).
+gfx_surface_t *gfx_set_target(gfx_surface_t *s);
 void put_pixel(int x, int y, u32 color);
 void draw_rect(int x, int y, int width, int height, u32 color);
 u32  get_pixel(int x,int y); 
 void draw_string(int x, int y, const char *s, u32 color);
+void draw_string_n(int x, int y, const char *s, int n, u32 color);   // first n chars, no NUL needed
+void gfx_draw_text(const gfx_font_t *font, int x, int y, const char *s, u32 color);
+int  gfx_text_width(const gfx_font_t *font, const char *s);
 void draw_button(int x, int y, int width, int height, u32 color, const char *text);
 void draw_window(int x, int y, int width, int height, u32 color, const char *title);
-void draw_line(int x0, int y0, int x1, int y1, u32 color);
+void draw_line(int x0, int y0, int x1, int y1, u32 color);   // clipped, endpoints inclusive
+void gfx_polyline(const gfx_point_t *pts, int count, u32 color);
+
+// Row-oriented kernels: clip once, then one 32-bit span per row.
+void gfx_fill_span(int x, int y, int width, u32 color);
+void draw_rounded(int x, int y, int width, int height, int radius, u32 color);
+void fill_circle(int cx, int cy, int radius, u32 color);
+void gfx_blit(int x, int y, int width, int height, const u32 *src, int src_stride);
+void gfx_scroll(int x, int y, int width, int height, int dy);   // move rows by dy in place
+
+// Surface blits. Modes: opaque copy; colour key (arg = key, matching source
+// pixels are skipped); per-pixel alpha over (premultiplied ARGB source);
+// constant alpha blend (arg = 0..255).
+#define GFX_BLIT_COPY  0
+#define GFX_BLIT_KEY   1
+#define GFX_BLIT_ALPHA 2
+#define GFX_BLIT_BLEND 3
+void gfx_blit_surface(int x, int y, const gfx_surface_t *src, int sx, int sy,
+                      int width, int height, int mode, u32 arg);
+void gfx_fill_blend(int x, int y, int width, int height, u32 argb);   // premultiplied colour over
+int  gfx_set_simd(int enable);   // SSE2 blend kernels; caller checks CPU/OS support
+const char *gfx_simd_name(void);
+
+// Back buffer presentation: drawing calls record damage, gfx_flush() copies
+// the damaged areas to the visible framebuffer (call once per frame).
+void gfx_damage(int x, int y, int width, int height);
+void gfx_flush(void);
+void gfx_set_display(const gfx_display_t *disp);
+u32  gfx_vram_size(void);   // bytes of framebuffer memory in use (all pages)
+
+// Cursor overlay, composited by gfx_flush(); moves in between are coalesced.
+void gfx_cursor_move(int x, int y);
+void gfx_cursor_hide(void);
 
 #endif
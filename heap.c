@@ -0,0 +1,505 @@
+// heap.c — kernel heap: size-class slabs for small blocks, a coalescing
+// boundary-tag allocator for large ones; malloc/free/calloc/realloc on top
+// for mbedTLS, plus the few other stdlib.h functions the kernel needs.
+#include <stdint.h>
+#include "heap.h"
+#include "stdlib.h"
+#include "string.h"
+#include "pmm.h"
+
+/* The heap region is handed out in 16 KiB chunks from a break pointer, and
+ * chunk_kind[] records what each chunk holds, so kfree() finds the owner of
+ * a pointer without trusting any header in front of it:
+ *  - a slab chunk starts with a slab_t and holds objects of one size class;
+ *  - a large arena is a run of chunks cut into blocks with a header carrying
+ *    their own and their left neighbour's size, merged with free neighbours
+ *    on release and kept on free lists binned by log2(size);
+ *  - slab chunks that become empty go to a cache any class can reuse.
+ * So the footprint follows the peak live size, not the allocation count.
+ * Not interrupt-safe: nothing allocates from IRQ context. */
+#define CHUNK_SHIFT 14
+#define CHUNK       (1u << CHUNK_SHIFT)
+#define NCHUNKS     (HEAP_MAX >> CHUNK_SHIFT)
+
+enum { K_NONE = 0, K_LARGE, K_EMPTY, K_SLAB };   // K_SLAB + class index
+
+static u8 chunk_kind[NCHUNKS];
+static u32 heap_base = 0, heap_end = 0, brk = 0;
+static heap_stats_t stats;
+
+static inline u32 addr(const void *p){ return (u32)(uintptr_t)p; }
+static inline u32 chunk_of(u32 a){ return (a - heap_base) >> CHUNK_SHIFT; }
+
+static void *chunks_take(u32 n){
+    if(n > (heap_end - brk) >> CHUNK_SHIFT) return 0;
+    void *p = (void*)(uintptr_t)brk;
+    brk += n*CHUNK;
+    stats.arena_bytes = brk - heap_base;
+    return p;
+}
+
+/* ------------------------------------------------------------
+Small blocks: one slab per 16 KiB chunk, free objects linked through
+their first word. A class keeps its slabs with free objects on a list;
+full slabs are off the list until something in them is freed.
+----------------------------------------------------------*/
+typedef struct slab {
+    struct slab *next, *prev;   // partial list of the class / empty cache
+    void *free;
+    u16 inuse, total;
+    u32 cls;
+    u8 site[];                  // allocation site slot of each object
+} slab_t;
+
+#define SITE_FREE 0xFF          // site[] of an object that is not allocated
+
+#define NCLASSES  16
+#define SMALL_MAX 2048
+static const u16 class_size[NCLASSES] = {
+    16, 32, 48, 64, 80, 96, 128, 160, 192, 256, 320, 384, 512, 768, 1024, 2048
+};
+static u8 size_class[SMALL_MAX/16 + 1];   // (size+15)/16 -> class
+static u16 class_total[NCLASSES];         // objects per slab
+static u16 class_off[NCLASSES];           // first object, 16-byte aligned
+static slab_t *partial[NCLASSES];
+static slab_t *empty_chunks;
+
+static inline slab_t *slab_of(u32 a){ return (slab_t*)(uintptr_t)(a & ~(CHUNK - 1)); }
+static inline u32 slab_index(slab_t *s, u32 a){ return (a - addr(s) - class_off[s->cls])/class_size[s->cls]; }
+
+/* Half of the free RAM (at most HEAP_MAX) goes to the heap; the rest stays
+ * with the frame allocator for page-granular users. If no free run is
+ * that long, halve the request until one is. */
+void heap_init(void){
+    for(u32 i=0, c=0;i<=SMALL_MAX/16;i++){
+        while(class_size[c] < i*16) c++;
+        size_class[i] = (u8)c;
+    }
+    for(int c=0;c<NCLASSES;c++){
+        u32 sz = class_size[c], n = (CHUNK - sizeof(slab_t))/(sz + 1), off;
+        while((off = (sizeof(slab_t) + n + 15) & ~15u) + n*sz > CHUNK) n--;
+        class_total[c] = (u16)n;
+        class_off[c] = (u16)off;
+    }
+    pmm_stats_t ps;
+    pmm_stats(&ps);
+    u32 size = ps.free_frames/2*PAGE_SIZE;
+    if(size > HEAP_MAX) size = HEAP_MAX;
+    size &= ~(CHUNK - 1);
+    u32 base = 0;
+    for(; size >= CHUNK; size = (size/2) & ~(CHUNK - 1))
+        if((base = pmm_alloc_contig(size/PAGE_SIZE, CHUNK)) != 0) break;
+    if(!base) return;
+    heap_base = brk = base;
+    heap_end = base + size;
+    stats.base = base;
+    stats.size = size;
+}
+
+static void *slab_alloc(u32 cls){
+    slab_t *s = partial[cls];
+    if(!s){
+        if(empty_chunks){ s = empty_chunks; empty_chunks = s->next; }
+        else if((s = chunks_take(1)) != 0) stats.slab_bytes += CHUNK;
+        else return 0;
+        u32 sz = class_size[cls];
+        s->cls = cls;
+        s->inuse = 0;
+        s->total = class_total[cls];
+        s->free = 0;
+        memset(s->site, SITE_FREE, s->total);
+        u8 *o = (u8*)s + class_off[cls] + (s->total - 1)*sz;
+        for(int i=0;i<s->total;i++, o -= sz){ *(void**)o = s->free; s->free = o; }
+        s->next = s->prev = 0;
+        partial[cls] = s;
+        chunk_kind[chunk_of(addr(s))] = K_SLAB + cls;
+    }
+    void *p = s->free;
+    s->free = *(void**)p;
+    s->site[slab_index(s, addr(p))] = 0;   // live; track() sets the real site
+    if(++s->inuse == s->total){            // full: s is the list head
+        partial[cls] = s->next;
+        if(s->next) s->next->prev = 0;
+    }
+    return p;
+}
+
+static void slab_free(slab_t *s, void *p){
+    s->site[slab_index(s, addr(p))] = SITE_FREE;
+    *(void**)p = s->free;
+    s->free = p;
+    if(s->inuse-- == s->total){
+        s->prev = 0;
+        s->next = partial[s->cls];
+        if(s->next) s->next->prev = s;
+        partial[s->cls] = s;
+    }else if(s->inuse == 0 && (s->prev || s->next)){
+        // keep one empty slab per class so alloc/free pairs do not churn
+        if(s->prev) s->prev->next = s->next; else partial[s->cls] = s->next;
+        if(s->next) s->next->prev = s->prev;
+        chunk_kind[chunk_of(addr(s))] = K_EMPTY;
+        s->next = empty_chunks;
+        empty_chunks = s;
+    }
+}
+
+/* ------------------------------------------------------------
+Large blocks. Every arena ends in a fence (size 0, used) so the last block
+has a right neighbour; the first block has prev_size 0. An arena taken
+right after the previous one turns the old fence into free space.
+----------------------------------------------------------*/
+typedef struct block {
+    u32 size;                   // whole block, header included; 0 = fence
+    u32 prev_size;              // size of the block to the left, 0 if none
+    u32 magic;
+    u32 site;                   // allocation site slot; keeps payloads 16-byte aligned
+    struct block *next, *prev;  // free list links, free blocks only
+} block_t;
+#define BHDR        16
+#define MIN_BLOCK   64
+#define BLOCK_USED  0x48454150u
+#define BLOCK_FREE  0x46524545u
+#define NBINS       28          // floor(log2(size)), sizes up to HEAP_MAX
+#define LARGE_ARENA (16*CHUNK)
+
+static block_t *bins[NBINS];
+static block_t *last_fence;
+
+static inline int bin_of(u32 size){ return 31 - __builtin_clz(size); }
+static inline block_t *next_block(block_t *b){ return (block_t*)((u8*)b + b->size); }
+static inline block_t *prev_block(block_t *b){ return (block_t*)((u8*)b - b->prev_size); }
+static inline u32 block_need(size_t sz){
+    u32 n = ((u32)sz + BHDR + 15) & ~15u;
+    return n < MIN_BLOCK ? MIN_BLOCK : n;
+}
+
+static void set_size(block_t *b, u32 size){
+    b->size = size;
+    next_block(b)->prev_size = size;
+}
+
+static void bin_insert(block_t *b){
+    int i = bin_of(b->size);
+    b->magic = BLOCK_FREE;
+    b->prev = 0;
+    b->next = bins[i];
+    if(b->next) b->next->prev = b;
+    bins[i] = b;
+    stats.large_free_bytes += b->size;
+}
+
+static void bin_remove(block_t *b){
+    if(b->prev) b->prev->next = b->next; else bins[bin_of(b->size)] = b->next;
+    if(b->next) b->next->prev = b->prev;
+    stats.large_free_bytes -= b->size;
+}
+
+// put a block that is on no list back, merged with free neighbours
+static void large_release(block_t *b){
+    block_t *n = next_block(b);
+    if(n->magic == BLOCK_FREE){
+        bin_remove(n);
+        n->magic = 0;
+        set_size(b, b->size + n->size);
+    }
+    if(b->prev_size){
+        block_t *p = prev_block(b);
+        if(p->magic == BLOCK_FREE){
+            bin_remove(p);
+            b->magic = 0;
+            set_size(p, p->size + b->size);
+            b = p;
+        }
+    }
+    bin_insert(b);
+}
+
+// cut a used block down to size bytes, freeing the tail if it is worth it
+static void large_trim(block_t *b, u32 size){
+    if(b->size - size < MIN_BLOCK) return;
+    block_t *t = (block_t*)((u8*)b + size);
+    u32 tail = b->size - size;
+    set_size(b, size);
+    t->magic = BLOCK_USED;
+    set_size(t, tail);
+    large_release(t);
+}
+
+static block_t *large_find(u32 need){
+    int i = bin_of(need);
+    for(block_t *b = bins[i]; b; b = b->next)
+        if(b->size >= need) return b;
+    // every block in a higher bin is at least twice the bin of need
+    for(i++; i<NBINS; i++)
+        if(bins[i]) return bins[i];
+    return 0;
+}
+
+static int large_grow(u32 need){
+    u32 bytes = (need + BHDR + CHUNK - 1) & ~(CHUNK - 1);   // + fence
+    u8 *a = bytes < LARGE_ARENA ? chunks_take(LARGE_ARENA >> CHUNK_SHIFT) : 0;
+    if(a) bytes = LARGE_ARENA;
+    else if(!(a = chunks_take(bytes >> CHUNK_SHIFT))) return -1;
+    for(u32 i=0;i<bytes >> CHUNK_SHIFT;i++) chunk_kind[chunk_of(addr(a)) + i] = K_LARGE;
+
+    block_t *b, *fence = (block_t*)(a + bytes - BHDR);
+    fence->size = 0;
+    fence->magic = BLOCK_USED;
+    if(last_fence && (u8*)last_fence + BHDR == a){
+        b = last_fence;                     // prev_size already right
+        b->magic = BLOCK_USED;
+        set_size(b, bytes);
+    }else{
+        b = (block_t*)a;
+        b->prev_size = 0;
+        b->magic = BLOCK_USED;
+        set_size(b, bytes - BHDR);
+    }
+    last_fence = fence;
+    large_release(b);
+    return 0;
+}
+
+static block_t *large_alloc(u32 need){
+    block_t *b = large_find(need);
+    if(!b){
+        if(large_grow(need) != 0) return 0;
+        b = large_find(need);
+    }
+    bin_remove(b);
+    b->magic = BLOCK_USED;
+    large_trim(b, need);
+    return b;
+}
+
+/* ------------------------------------------------------------
+Allocation sites. Each entry point records its caller's return address;
+a live block remembers the table slot of its site (a byte per object
+after the slab header, the site field of a large block header), so frees
+and in-place resizes are charged back to the right site. Plain counters:
+one CPU and no allocation from IRQ context, so nothing to lock. Slot 0
+collects whatever does not fit once the table is full; slot SITE_FREE is
+never handed out, it marks free slab objects.
+----------------------------------------------------------*/
+#define NSITES 256
+
+static heap_site_t sites[NSITES];
+
+static u8 site_slot(void *ra){
+    u32 a = addr(ra), h = (a*2654435761u) >> 24;
+    for(int i=0;i<NSITES;i++, h = (h + 1) & (NSITES - 1)){
+        if(!h || h == SITE_FREE) continue;
+        if(sites[h].site == a) return (u8)h;
+        if(!sites[h].site){ sites[h].site = a; return (u8)h; }
+    }
+    return 0;
+}
+
+static void site_add(u8 id, u32 bytes){
+    heap_site_t *s = &sites[id];
+    s->allocs++;
+    s->bytes += bytes;
+    if((s->live += bytes) > s->peak) s->peak = s->live;
+    stats.allocs++;
+    if((stats.used_bytes += bytes) > stats.peak_used_bytes) stats.peak_used_bytes = stats.used_bytes;
+}
+
+static void site_sub(u8 id, u32 bytes){
+    sites[id].frees++;
+    sites[id].live -= bytes;
+    stats.frees++;
+    stats.used_bytes -= bytes;
+}
+
+
+static u8 *site_ref(void *p){
+    u32 a = addr(p);
+    if(chunk_kind[chunk_of(a)] == K_LARGE) return (u8*)&((block_t*)((u8*)p - BHDR))->site;
+    slab_t *s = slab_of(a);
+    return &s->site[slab_index(s, a)];
+}
+
+static void *track(void *p, void *ra){
+    if(p){
+        u8 id = site_slot(ra);
+        *site_ref(p) = id;
+        site_add(id, (u32)ksize(p));
+    }
+    return p;
+}
+
+/* ------------------------------------------------------------
+Entry points
+----------------------------------------------------------*/
+static void *alloc(size_t sz){
+    if(sz <= SMALL_MAX) return slab_alloc(size_class[(sz + 15) >> 4]);
+    if(sz > HEAP_MAX) return 0;
+    block_t *b = large_alloc(block_need(sz));
+    return b ? (u8*)b + BHDR : 0;
+}
+
+static void *alloc_zero(size_t n, size_t sz, void *ra){
+    if(sz && n > (size_t)-1/sz) return 0;
+    void *p = track(alloc(n*sz), ra);
+    if(p) memset(p, 0, n*sz);
+    return p;
+}
+
+size_t ksize(const void *p){
+    u32 a = addr(p);
+    if(a < heap_base || a >= brk || (a & 15)) return 0;
+    u8 k = chunk_kind[chunk_of(a)];
+    if(k >= K_SLAB){
+        u32 cls = k - K_SLAB, off = a & (CHUNK - 1);
+        if(off < class_off[cls] || (off - class_off[cls]) % class_size[cls]) return 0;
+        u32 i = (off - class_off[cls])/class_size[cls];
+        if(i >= class_total[cls] || slab_of(a)->site[i] == SITE_FREE) return 0;
+        return class_size[cls];
+    }
+    if(k == K_LARGE){
+        const block_t *b = (const block_t*)((const u8*)p - BHDR);
+        if(b->magic == BLOCK_USED && b->size) return b->size - BHDR;
+    }
+    return 0;
+}
+
+static void release(void *p){
+    if(!p) return;
+    size_t sz = ksize(p);
+    if(!sz){ stats.bad_frees++; return; }
+    site_sub(*site_ref(p), (u32)sz);
+    u32 a = addr(p);
+    if(chunk_kind[chunk_of(a)] == K_LARGE) large_release((block_t*)((u8*)p - BHDR));
+    else slab_free(slab_of(a), p);
+}
+
+static void *resize(void *p, size_t sz, void *ra){
+    if(!p) return track(alloc(sz), ra);
+    if(!sz){ release(p); return 0; }
+    size_t old = ksize(p);
+    if(!old) return 0;
+    u8 k = chunk_kind[chunk_of(addr(p))];
+
+    if(k >= K_SLAB && sz <= SMALL_MAX && size_class[(sz + 15) >> 4] == k - K_SLAB)
+        return p;
+    if(k == K_LARGE && sz > SMALL_MAX && sz <= HEAP_MAX){
+        // resize in place, growing into a free right neighbour if there is one
+        block_t *b = (block_t*)((u8*)p - BHDR), *n = next_block(b);
+        u32 need = block_need(sz);
+        if(need > b->size && n->magic == BLOCK_FREE && b->size + n->size >= need){
+            bin_remove(n);
+            n->magic = 0;
+            set_size(b, b->size + n->size);
+        }
+        if(need <= b->size){
+            // a resize in place counts as a free and an allocation of the site
+            site_sub(b->site, (u32)old);
+            large_trim(b, need);
+            site_add(b->site, b->size - BHDR);
+            return p;
+        }
+    }
+    void *q = track(alloc(sz), ra);
+    if(!q) return 0;
+    memcpy(q, p, old < sz ? old : sz);
+    release(p);
+    return q;
+}
+
+// Over-allocate a large block and give back the part in front of the
+// aligned address (at least MIN_BLOCK so it can stand on its own; for
+// align < MIN_BLOCK that can take more than one step of align).
+static void *alloc_aligned(size_t sz, size_t align){
+    if(align <= 16) return alloc(sz);
+    if(align & (align - 1) || sz > HEAP_MAX || align > HEAP_MAX) return 0;
+    block_t *b = large_alloc(block_need(sz) + align + MIN_BLOCK);
+    if(!b) return 0;
+    u32 p = addr(b) + BHDR;
+    u32 a = (p + align - 1) & ~(align - 1);
+    if(a != p){
+        while(a - p < MIN_BLOCK) a += align;
+        block_t *nb = (block_t*)(uintptr_t)(a - BHDR);
+        u32 lead = a - p;
+        nb->magic = BLOCK_USED;
+        set_size(nb, b->size - lead);
+        set_size(b, lead);
+        large_release(b);
+        b = nb;
+    }
+    large_trim(b, block_need(sz));
+    return (u8*)b + BHDR;
+}
+
+#define CALLER __builtin_return_address(0)
+
+void *kmalloc(size_t sz){ return track(alloc(sz), CALLER); }
+void *kcalloc(size_t n, size_t sz){ return alloc_zero(n, sz, CALLER); }
+void *krealloc(void *p, size_t sz){ return resize(p, sz, CALLER); }
+void *kmalloc_aligned(size_t sz, size_t align){ return track(alloc_aligned(sz, align), CALLER); }
+void kfree(void *p){ release(p); }
+
+void heap_stats(heap_stats_t *st){ *st = stats; }
+
+int heap_sites(heap_site_t *out, int max){
+    int n = 0;
+    for(int i=0;i<NSITES && n<max;i++)
+        if(sites[i].allocs) out[n++] = sites[i];
+    return n;
+}
+
+static char *fmt_hex(char *o, u32 v){
+    for(int i=28;i>=0;i-=4) *o++ = "0123456789abcdef"[(v >> i) & 15];
+    return o;
+}
+
+// right-aligned in w columns
+static char *fmt_dec(char *o, u64 v, int w){
+    char t[24];
+    int n = 0;
+    do{ t[n++] = (char)('0' + v % 10); v /= 10; }while(v);
+    while(w-- > n) *o++ = ' ';
+    while(n) *o++ = t[--n];
+    return o;
+}
+
+/* One line per site in table order, then the totals. Sites are return
+ * addresses: resolve them with addr2line -e kernel.bin. */
+void heap_dump(void (*puts)(const char *s)){
+    char line[96], *o;
+    puts("heap: site         allocs    frees       bytes        live        peak\n");
+    for(int i=0;i<NSITES;i++){
+        const heap_site_t *s = &sites[i];
+        if(!s->allocs) continue;
+        o = line;
+        *o++ = ' '; *o++ = ' ';
+        if(s->site){ *o++ = '0'; *o++ = 'x'; o = fmt_hex(o, s->site); }
+        else{ memcpy(o, "(other)   ", 10); o += 10; }
+        o = fmt_dec(o, s->allocs, 9);
+        o = fmt_dec(o, s->frees, 9);
+        o = fmt_dec(o, s->bytes, 12);
+        o = fmt_dec(o, s->live, 12);
+        o = fmt_dec(o, s->peak, 12);
+        *o++ = '\n'; *o = 0;
+        puts(line);
+    }
+    o = line;
+    memcpy(o, "  total     ", 12); o += 12;
+    o = fmt_dec(o, stats.allocs, 9);
+    o = fmt_dec(o, stats.frees, 9);
+    memset(o, ' ', 12); o += 12;
+    o = fmt_dec(o, stats.used_bytes, 12);
+    o = fmt_dec(o, stats.peak_used_bytes, 12);
+    *o++ = '\n'; *o = 0;
+    puts(line);
+}
+
+// stdlib.h
+void *malloc(size_t sz){ return track(alloc(sz), CALLER); }
+void free(void *p){ release(p); }
+void *calloc(size_t n, size_t size){ return alloc_zero(n, size, CALLER); }
+void *realloc(void *p, size_t sz){ return resize(p, sz, CALLER); }
+void abort(void){ for(;;); }
+
+static unsigned int rng_state = 1;
+int rand(void){ rng_state = rng_state*1103515245 + 12345; return (int)(rng_state>>16); }
+void srand(unsigned int seed){ rng_state = seed ? seed : 1; }
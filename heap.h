@@ -0,0 +1,47 @@
+#ifndef HEAP_H
+#define HEAP_H
+
+#include <stddef.h>
+#include "common.h"
+
+// Kernel heap: one physically contiguous region taken from the frame
+// allocator by heap_init(), at most HEAP_MAX bytes. All blocks are 16-byte
+// aligned; nothing can be allocated before heap_init().
+#define HEAP_MAX (128u << 20)
+
+void  heap_init(void);
+
+void *kmalloc(size_t sz);
+void *kcalloc(size_t n, size_t sz);
+void *krealloc(void *p, size_t sz);
+void *kmalloc_aligned(size_t sz, size_t align);   // align: power of two
+void  kfree(void *p);                             // NULL and foreign pointers are ignored
+size_t ksize(const void *p);                      // usable bytes of a live block
+
+typedef struct {
+    u32 base, size;         // the heap region
+    u32 arena_bytes;        // taken from the heap region so far
+    u32 slab_bytes;         // in slab chunks (partial, full or cached empty)
+    u32 large_free_bytes;   // on the large-block free lists
+    u32 used_bytes;         // usable bytes of live blocks
+    u32 peak_used_bytes;    // high-water mark of used_bytes
+    u32 allocs, frees;
+    u32 bad_frees;          // pointers kfree() did not recognise
+} heap_stats_t;
+
+void heap_stats(heap_stats_t *st);
+
+// Per call site accounting, always on. A site is the return address of the
+// kmalloc/malloc/... call; byte counts are usable sizes, as ksize() reports.
+// A resize in place counts as a free and an allocation at the same site.
+typedef struct {
+    u32 site;               // 0: sites that did not fit in the table
+    u32 allocs, frees;
+    u64 bytes;              // allocated over time
+    u32 live, peak;         // live bytes now and at most
+} heap_site_t;
+
+int  heap_sites(heap_site_t *out, int max);        // fills up to max, returns count
+void heap_dump(void (*puts)(const char *s));      // table of all sites, e.g. to serial
+
+#endif
@@ -11,6 +11,10 @@
 #include "string.h"
 #include <stdint.h>
 #include "rtl8139.h"   // needed so we can poll NIC during waits
+#include "ktime.h"
+
+#define HTTP_CONNECT_MS 3000   // SYN to SYN/ACK
+#define HTTP_IDLE_MS    5000   // no data and no FIN: give up on the response
 
 // Debug exports
 int http_last_ret = 0;
@@ -87,12 +91,11 @@ int http_get_by_ip_port(uint32_t ip, uint16_t port, const char *host_header, con
         http_last_tcp_state = 0;
         if (tcp_connect(&g_sock, ip, port, 0) != 0) { http_last_ret = -2; return -2; }
 
-        // wait for SYN/ACK with a longer timeout
-        int waited = 0;
-        while (g_sock.state != TCP_ESTABLISHED && waited < 300000) {
+        // wait for SYN/ACK
+        deadline_t connect_by = ktime_deadline_ms(HTTP_CONNECT_MS);
+        while (g_sock.state != TCP_ESTABLISHED && !ktime_expired(connect_by)) {
             rtl8139_poll();
             http_last_tcp_state = g_sock.state;
-            waited++;
         }
         if (g_sock.state != TCP_ESTABLISHED){ tcp_close(&g_sock); http_last_ret = -3; return -3; }
 
@@ -114,16 +117,21 @@ int http_get_by_ip_port(uint32_t ip, uint16_t port, const char *host_header, con
         #define RAW_CAP 32768
         static char raw[RAW_CAP];
 
+        deadline_t idle_by = ktime_deadline_ms(HTTP_IDLE_MS);
         while (total_raw < RAW_CAP - 1) {
             rtl8139_poll(); // pump NIC regularly so we actually receive TCP segments
 
             int got = tcp_recv(&g_sock, raw + total_raw, RAW_CAP - 1 - total_raw);
             if (got > 0) {
                 total_raw += got;
+                idle_by = ktime_deadline_ms(HTTP_IDLE_MS);
             } else {
                 // break if connection closing
                 if (g_sock.state == TCP_FIN_WAIT1 || g_sock.state == TCP_FIN_WAIT2 || g_sock.state == TCP_TIME_WAIT)
                     break;
+                // or the server went quiet; take what arrived
+                if (ktime_expired(idle_by))
+                    break;
                 // otherwise spin and let poll bring in more packets
             }
         }
@@ -138,8 +146,8 @@ int http_get_by_ip_port(uint32_t ip, uint16_t port, const char *host_header, con
         int status = parse_http_status(raw);
         if (status >= 300 && status < 400){
             // find Location header
-            char *loc = strstr(raw, "Location:");
-            if (!loc) loc = strstr(raw, "location:");
+            char *loc = memmem(raw, total_raw, "Location:", 9);
+            if (!loc) loc = memmem(raw, total_raw, "location:", 9);
             if (!loc){ http_last_ret = -12; return -12; }
             // skip to value
             loc = strchr(loc, ':'); if(!loc) { http_last_ret = -12; return -12; }
@@ -197,11 +205,13 @@ int http_get_by_ip_port(uint32_t ip, uint16_t port, const char *host_header, con
         }
 
         // Not a redirect (or reached final). Find start of body
-        char *body = strstr(raw, "\r\n\r\n");
+        char *body = memmem(raw, total_raw, "\r\n\r\n", 4);
         if (body) body += 4; else body = raw;
 
-        // copy up to out_cap-1 bytes and terminate
-        int body_len = (int)strlen(body);
+        // copy up to out_cap-1 bytes and terminate (the body ends at the
+        // first NUL, as it did when this was a strlen)
+        char *nul = memchr(body, 0, raw + total_raw - body);
+        int body_len = (int)((nul ? nul : raw + total_raw) - body);
         if (body_len > out_cap - 1) body_len = out_cap - 1;
         if (body_len > 0) memcpy(out, body, body_len);
         out[body_len] = '\0';
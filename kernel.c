@@ -12,6 +12,17 @@
 #include "syscalls.h"
 #include "stdio.h"
 #include "json.h"
+#include "paging.h"
+#include "cpu.h"
+#include "drivers/bga.h"
+#include "drivers/virtio_gpu.h"
+#include "wm.h"
+#include "font.h"
+#include "psf.h"
+#include "pmm.h"
+#include "heap.h"
+#include "fpu.h"
+#include "ktime.h"
 
 /* Expose mbedTLS debug buffer accessor implemented in platform_shim.c */
 extern const char *mbedtls_get_debug(void);
@@ -30,32 +41,11 @@ static inline int clampi(int v,int lo,int hi){
     return v;
 }
 
-static void draw_rounded(int x,int y,int w,int h,int r,u32 col){
-    // body
-    draw_rect(x+r, y,     w-2*r, h,     col);
-    draw_rect(x,   y+r,   r,     h-2*r, col);
-    draw_rect(x+w-r, y+r, r,     h-2*r, col);
-    // corners
-    for(int dy=0; dy<r; dy++){
-        for(int dx=0; dx<r; dx++){
-            if(dx*dx + dy*dy <= r*r){
-                put_pixel(x+r-dx,   y+r-dy,   col);
-                put_pixel(x+w-r+dx, y+r-dy,   col);
-                put_pixel(x+r-dx,   y+h-r+dy, col);
-                put_pixel(x+w-r+dx, y+h-r+dy, col);
-            }
-        }
-    }
-}
-
 /* ------------------------------------------------------------
 - 
-Static software cursor (8x8 arrow) with save/restore
+Software cursor: position only; graphics.c composites the arrow over
+the back buffer at flush time, so nothing is saved or restored here.
 ----------------------------------------------------------*/
-#define CUR_W 8
-#define CUR_H 8
-static u32 cursor_under[CUR_H][CUR_W];
-static int cur_saved = 0;
 static int cur_x = 0, cur_y = 0;
 
 /* UDP proxy state for host-side UDP->HTTP helper */
@@ -63,54 +53,10 @@ static volatile int udp_proxy_ready = 0;
 static int udp_proxy_len = 0;
 static char udp_proxy_buf[2048];
 
-static void cursor_save_under(int x, int y){
-    for(int j=0;j<CUR_H;j++){
-        for(int i=0;i<CUR_W;i++){
-            int px = x+i, py = y+j;
-            if(px>=0 && py>=0 && px<(int)framebuffer_width && py<(int)framebuffer_height){
-                cursor_under[j][i] = get_pixel(px,py);
-            }else{
-                cursor_under[j][i] = 0; // offscreen safety
-            }
-        }
-    }
-    cur_saved = 1;
-}
-
-static void cursor_restore_under(void){
-    if(!cur_saved) return;
-    for(int j=0;j<CUR_H;j++){
-        for(int i=0;i<CUR_W;i++){
-            int px = cur_x+i, py = cur_y+j;
-            if(px>=0 && py>=0 && px<(int)framebuffer_width && py<(int)framebuffer_height){
-                put_pixel(px,py,cursor_under[j][i]);
-            }
-        }
-    }
-    cur_saved = 0;
-}
-
-static void cursor_draw_shape(int x, int y, u32 col){
-    // simple 8×8 left-top arrow
-    for(int j=0;j<CUR_H;j++){
-        for(int i=0;i<=j;i++){
-            int px=x+i, py=y+j;
-            if(px>=0 && py>=0 && px<(int)framebuffer_width && py<(int)framebuffer_height){
-                put_pixel(px,py,col);
-            }
-        }
-    }
-}
-
 static void cursor_move_to(int x, int y){
-    // restore previous background
-    cursor_restore_under();
-    // clamp and set new pos
     cur_x = clampi(x,0,(int)framebuffer_width-1);
     cur_y = clampi(y,0,(int)framebuffer_height-1);
-    // save new background & draw cursor
-    cursor_save_under(cur_x,cur_y);
-    cursor_draw_shape(cur_x,cur_y,0x000000);
+    gfx_cursor_move(cur_x,cur_y);
 }
 
 /* ------------------------------------------------------------
@@ -135,30 +81,6 @@ static int mouse_read_packet(int *dx, int *dy, unsigned char *buttons){
     return 1;
 }
 
-/* ===========================================================
-Helpers for start menu (file-scope, no nested funcs)
-===========================================================*/
-static void draw_start_menu(int sm_x,int sm_y,int sm_w,int sm_h){
-    draw_rect(sm_x,sm_y,sm_w,sm_h,0xDDDDDD);
-    draw_string(sm_x+16, sm_y+20, "Calculator",   0x000000);
-    draw_string(sm_x+16, sm_y+50, "Browser",      0x000000);
-    draw_string(sm_x+16, sm_y+80, "Notes (dummy)",0x666666);
-    draw_string(sm_x+16, sm_y+50, "Browser (Posts)",      0x000000);
-    draw_string(sm_x+16, sm_y+80, "JSON Viewer (Users)",0x000000);
-    draw_string(sm_x+16, sm_y+110,"Paint (dummy)",0x666666);
-    // new menu item for running embedded user program
-    draw_string(sm_x+16, sm_y+140, "Run embedded hello", 0x000000);
-}
-
-static void clear_start_menu(int sm_x,int sm_y,int sm_w,int sm_h,
-                            int bar_h,int sb_x,int sb_y,int sb_w,int sb_h){
-    // repaint the area with desktop bg and redraw the taskbar and start button
-    draw_rect(sm_x,sm_y,sm_w,sm_h,0x87CEEB);
-    draw_rect(0,framebuffer_height-bar_h,framebuffer_width,bar_h,0x333333);
-    draw_rect(sb_x,sb_y,sb_w,sb_h,0x8888FF);
-    draw_string(sb_x+6,sb_y+8,"S",0xFFFFFF);
-}
-
 /* ===========================================================
 WELCOME SCREEN
 ===========================================================*/
@@ -182,6 +104,7 @@ static int show_welcome(void){
 
     while(1){
         if (rtl8139_is_ready()) rtl8139_poll();
+        gfx_flush();
 
         int dx, dy; unsigned char btn;
         if(mouse_read_packet(&dx,&dy,&btn)){
@@ -189,7 +112,6 @@ static int show_welcome(void){
 
             if(btn & 1){ // left button
                 if(cur_x>nx && cur_x<nx+100 && cur_y>ny && cur_y<ny+50){
-                    cursor_restore_under();
                     return 1;
                 }
             }
@@ -198,98 +120,193 @@ static int show_welcome(void){
 }
 
 /* ===========================================================
-DESKTOP + TASKBAR
-Returns: 1 = Calculator, 2 = Browser
+DESKTOP: windows are owned by wm.c; this file only creates them, draws
+into their surfaces and reacts to clicks routed by wm_hit().
 ===========================================================*/
-static int show_desktop(void){
-    // desktop background
-    draw_rect(0,0,framebuffer_width,framebuffer_height,0x87CEEB);
-    if (rtl8139_is_ready()) {
-        draw_string(20, 20, "NIC: 10.0.2.15 OK", 0x00AA00);
+#define DESKTOP_BG 0x87CEEB
+
+/* UI text: a PSF2 font passed as a multiboot module, else the anti-aliased
+ * atlas built from the 8x8 font at build time (see tools/mkfont.c) */
+static gfx_font_t boot_font;
+static const gfx_font_t *ui_font = &font_ui_aa;
+
+// text centred in a widget
+static void ui_label(wm_widget_t *wg, const char *s, u32 color){
+    gfx_draw_text(ui_font, wg->x + (wg->w - gfx_text_width(ui_font, s))/2,
+                  wg->y + (wg->h - ui_font->height)/2, s, color);
+}
+#define BAR_H      40
+#define SB_X 8
+#define SB_Y 6
+#define SB_W 28
+#define SB_H 28
+#define SM_W 220
+#define SM_H 180
+
+static wm_window_t *taskbar_win = 0, *start_menu_win = 0;
+static wm_window_t *calc_win = 0, *browser_win = 0, *json_win = 0;
+
+static void calculator_ui(void);
+static void browser_ui(void);
+static void json_viewer_ui(void);
+
+static void run_embedded_hello(void){
+    // attempt to run embedded ELF if present
+    if (get_hello_ptr && get_hello_len && get_hello_len() > 0) {
+        console_puts("Running embedded program...\n");
+        int rc = elf32_load_and_run((const void*)get_hello_ptr(), (size_t)get_hello_len());
+        // convert rc to string
+        char numbuf[16]; int n=0; int t = rc; if(t==0) numbuf[n++]='0'; else { if(t<0){ numbuf[n++]='-'; t=-t; } int st=0; int tmp=t; while(tmp>0){ numbuf[n+st++] = '0' + (tmp%10); tmp/=10; } for(int i=0;i<st/2;i++){
+            char c=n+i; char d=n+st-1-i; char tmpc = numbuf[c]; numbuf[c]=numbuf[d]; numbuf[d]=tmpc; }
+            n += st; }
+        numbuf[n]=0;
+        console_puts("User program exited with code: ");
+        console_puts(numbuf);
+        console_puts("\n");
     } else {
-        draw_string(20, 20, "NIC: NOT READY", 0xFF0000);
+        console_puts("No embedded program present. Run make userprog and embed-userprog first.\n");
     }
+}
+
+static void close_start_menu(void){
+    if(start_menu_win){ wm_destroy(start_menu_win); start_menu_win = 0; }
+}
+
+/* Start menu: one widget per row, id = row. Rows are 30px apart. */
+static const char *const menu_labels[] = {
+    "Calculator", "Browser (Posts)", "JSON Viewer (Users)", "Paint (dummy)", "Run embedded hello"
+};
+#define MENU_ITEMS ((int)(sizeof(menu_labels)/sizeof(menu_labels[0])))
+static wm_widget_t menu_items[MENU_ITEMS];
+
+static void menu_item_paint(wm_widget_t *wg){
+    gfx_draw_text(ui_font, wg->x, wg->y + (wg->h - ui_font->height)/2, menu_labels[wg->id],
+                  wg->click ? 0x000000 : 0x666666);
+}
+
+static void menu_item_click(wm_widget_t *wg,int x,int y){
+    (void)x; (void)y;
+    int item = wg->id;
+    close_start_menu();
+    if(item == 0) calculator_ui();
+    else if(item == 1) browser_ui();
+    else if(item == 2) json_viewer_ui();
+    else if(item == 4) run_embedded_hello();
+}
+
+static void open_start_menu(void){
+    start_menu_win = wm_create(0, (int)framebuffer_height-BAR_H-SM_H, SM_W, SM_H,
+                               WM_UNDECORATED, "Start", 0xDDDDDD);
+    if(!start_menu_win) return;
+    for(int i=0;i<MENU_ITEMS;i++){
+        wm_widget_t *wg = &menu_items[i];
+        wg->x = 16; wg->y = 16 + i*30; wg->w = 164; wg->h = 20;
+        wg->id = i;
+        wg->paint = menu_item_paint;
+        wg->click = i == 3 ? 0 : menu_item_click;   // Paint is a placeholder
+        wm_add_widget(start_menu_win, wg);
+    }
+}
 
-    // taskbar
-    const int bar_h=40;
-    draw_rect(0,framebuffer_height-bar_h,framebuffer_width,bar_h,0x333333);
+/* Taskbar: the start button toggles the menu */
+static wm_widget_t start_button;
 
-    // start button (bottom-left)
-    const int sb_x=8, sb_y=(int)framebuffer_height-bar_h+6, sb_w=28, sb_h=28;
-    draw_rect(sb_x,sb_y,sb_w,sb_h,0x8888FF);
-    draw_string(sb_x+6,sb_y+8,"S",0xFFFFFF);
+static void start_button_paint(wm_widget_t *wg){
+    draw_rect(wg->x,wg->y,wg->w,wg->h,0x8888FF);
+    ui_label(wg, "S", 0xFFFFFF);
+}
+
+static void start_button_click(wm_widget_t *wg,int x,int y){
+    (void)wg; (void)x; (void)y;
+    if(start_menu_win) close_start_menu();
+    else               open_start_menu();
+}
+
+/* NIC status label; repainted only when the NIC state changes (id holds
+ * the state it was last painted with). Clicking it dumps the heap's
+ * per-site allocation table to serial. */
+static wm_widget_t nic_label;
+static void serial_early_puts(const char *s);
+
+static void nic_label_paint(wm_widget_t *wg){
+    wg->id = rtl8139_is_ready();
+    draw_rect(wg->x,wg->y,wg->w,wg->h,DESKTOP_BG);
+    if(wg->id) draw_string(wg->x, wg->y, "NIC: 10.0.2.15 OK", 0x00AA00);
+    else       draw_string(wg->x, wg->y, "NIC: NOT READY", 0xFF0000);
+}
 
-    // start menu rect (bottom-left popup)
-    const int sm_x=0, sm_w=220, sm_h=180; // increased height to fit new item
-    const int sm_y=(int)framebuffer_height-bar_h-sm_h;
+static void nic_label_click(wm_widget_t *wg,int x,int y){
+    (void)wg; (void)x; (void)y;
+    heap_dump(serial_early_puts);
+}
+
+static void close_window(wm_window_t *w){
+    if(w == calc_win) calc_win = 0;
+    if(w == browser_win) browser_win = 0;
+    if(w == json_win) json_win = 0;
+    wm_destroy(w);
+}
 
-    int start_open=0;
+static void desktop_click(int x,int y,wm_window_t **drag,int *grab_x,int *grab_y){
+    int lx, ly, part;
+    wm_window_t *w = wm_hit(x, y, &lx, &ly, &part);
+    // a click outside the menu and the taskbar closes the start menu (taskbar
+    // clicks that miss the start button close it below)
+    if(w != start_menu_win && w != taskbar_win) close_start_menu();
+    if(!w) return;
+    if(!(w->flags & WM_UNDECORATED)) wm_raise(w);
+    if(part == WM_HIT_CLOSE){
+        close_window(w);
+    }else if(part == WM_HIT_TITLE){
+        *drag = w;
+        *grab_x = x - w->x;
+        *grab_y = y - w->y;
+    }else if(!wm_click(w, lx, ly) && w == taskbar_win){
+        close_start_menu();
+    }
+}
 
-    // draw cursor (restore if any old)
-    cursor_move_to(cur_x, cur_y);
+static void show_desktop(void){
+    wm_init(DESKTOP_BG);
 
+    wm_window_t *status = wm_create(20, 20, 8*17, 8, WM_UNDECORATED, "Status", DESKTOP_BG);
+    if(status){
+        nic_label.x = 0; nic_label.y = 0; nic_label.w = 8*17; nic_label.h = 8;
+        nic_label.paint = nic_label_paint;
+        nic_label.click = nic_label_click;
+        wm_add_widget(status, &nic_label);
+    }
+
+    // taskbar with the start button (bottom-left)
+    taskbar_win = wm_create(0, (int)framebuffer_height-BAR_H, (int)framebuffer_width, BAR_H,
+                            WM_UNDECORATED, "Taskbar", 0x333333);
+    if(taskbar_win){
+        start_button.x = SB_X; start_button.y = SB_Y; start_button.w = SB_W; start_button.h = SB_H;
+        start_button.paint = start_button_paint;
+        start_button.click = start_button_click;
+        wm_add_widget(taskbar_win, &start_button);
+    }
+
+    wm_window_t *drag = 0;
+    int grab_x = 0, grab_y = 0, was_down = 0;
     while(1){
         if (rtl8139_is_ready()) rtl8139_poll();
+        if (status && nic_label.id != rtl8139_is_ready()) wm_invalidate(&nic_label);
+        // repaints only what was invalidated; an idle desktop draws nothing
+        wm_compose();
+        gfx_flush();
 
         int dx, dy; unsigned char btn;
         if(mouse_read_packet(&dx,&dy,&btn)){
             cursor_move_to(cur_x+dx, cur_y+dy);
-
-            if(btn & 1){ // left click
-                // start button toggle
-                if(cur_x>sb_x && cur_x<sb_x+sb_w && cur_y>sb_y && cur_y<sb_y+sb_h){
-                    start_open = !start_open;
-                    if(start_open) draw_start_menu(sm_x,sm_y,sm_w,sm_h);
-                    else           clear_start_menu(sm_x,sm_y,sm_w,sm_h,bar_h,sb_x,sb_y,sb_w,sb_h);
-                    continue;
-                }
-
-                if(start_open){
-                    // Calculator
-                    if(cur_x>sm_x+16 && cur_x<sm_x+180 &&
-                    cur_y>sm_y+16 && cur_y<sm_y+36){
-                        clear_start_menu(sm_x,sm_y,sm_w,sm_h,bar_h,sb_x,sb_y,sb_w,sb_h);
-                        return 1;
-                    }
-                    // Browser
-                    if(cur_x>sm_x+16 && cur_x<sm_x+180 &&
-                    cur_y>sm_y+46 && cur_y<sm_y+66){
-                        clear_start_menu(sm_x,sm_y,sm_w,sm_h,bar_h,sb_x,sb_y,sb_w,sb_h);
-                        return 2;
-                    }
-                    // JSON Viewer
-                    if(cur_x>sm_x+16 && cur_x<sm_x+180 &&
-                    cur_y>sm_y+76 && cur_y<sm_y+96){
-                        clear_start_menu(sm_x,sm_y,sm_w,sm_h,bar_h,sb_x,sb_y,sb_w,sb_h);
-                        return 3;
-                    }
-                    // Run embedded hello (new)
-                    if(cur_x>sm_x+16 && cur_x<sm_x+180 &&
-                    cur_y>sm_y+136 && cur_y<sm_y+156){
-                        clear_start_menu(sm_x,sm_y,sm_w,sm_h,bar_h,sb_x,sb_y,sb_w,sb_h);
-                        // attempt to run embedded ELF if present
-                        if (get_hello_ptr && get_hello_len && get_hello_len() > 0) {
-                            console_puts("Running embedded program...\n");
-                            int rc = elf32_load_and_run((const void*)get_hello_ptr(), (size_t)get_hello_len());
-                            // convert rc to string
-                            char numbuf[16]; int n=0; int t = rc; if(t==0) numbuf[n++]='0'; else { if(t<0){ numbuf[n++]='-'; t=-t; } int st=0; int tmp=t; while(tmp>0){ numbuf[n+st++] = '0' + (tmp%10); tmp/=10; } for(int i=0;i<st/2;i++){
-                                char c=n+i; char d=n+st-1-i; char tmpc = numbuf[c]; numbuf[c]=numbuf[d]; numbuf[d]=tmpc; }
-                                n += st; }
-                            numbuf[n]=0;
-                            console_puts("User program exited with code: ");
-                            console_puts(numbuf);
-                            console_puts("\n");
-                        } else {
-                            console_puts("No embedded program present. Run make userprog and embed-userprog first.\n");
-                        }
-                    }
-                    // click outside menu closes it
-                    if(!(cur_x>sm_x && cur_x<sm_x+sm_w && cur_y>sm_y && cur_y<sm_y+sm_h)){
-                        start_open=0;
-                        clear_start_menu(sm_x,sm_y,sm_w,sm_h,bar_h,sb_x,sb_y,sb_w,sb_h);
-                    }
-                }
+            int down = btn & 1;   // left button
+            if(drag){
+                if(down) wm_move(drag, cur_x - grab_x, cur_y - grab_y);
+                else     drag = 0;
+            }else if(down && !was_down){
+                desktop_click(cur_x, cur_y, &drag, &grab_x, &grab_y);
             }
+            was_down = down;
         }
     }
 }
@@ -299,6 +316,11 @@ CALCULATOR
 ===========================================================*/
 #define BW 60
 #define BH 40
+#define CALC_W  300
+#define CALC_H  300
+#define DISP_Y  (WM_TITLE_H+10)
+#define KEYS_Y  (WM_TITLE_H+80)
+static const char *calc_keys="789/456*123-0.=+C";
 static char expr[64]={0}; static int expr_len=0;
 
 static void calc_add(char c){ if(expr_len<63){expr[expr_len++]=c; expr[expr_len]=0;}}
@@ -324,75 +346,52 @@ static void calc_eval(void){
     while(n--) calc_add(buf[n]);
 }
 
-static void draw_key(int x,int y,char c){
-    draw_rect(x,y,BW,BH,0xAAAAAA);
-    char s[2]={c,0};
-    draw_string(x+25,y+13,s,0x000000);
+static wm_widget_t calc_display, calc_key_widgets[16];
+
+static void calc_display_paint(wm_widget_t *wg){
+    draw_rect(wg->x,wg->y,wg->w,wg->h,0xFFFFFF);
+    gfx_draw_text(ui_font, wg->x+10, wg->y + (wg->h - ui_font->height)/2, expr, 0x000000);
 }
 
-static void calculator_ui(void){
-    // redraw desktop bg behind window (no animation)
-    draw_rect(0,0,framebuffer_width,framebuffer_height,0x87CEEB);
+static void calc_key_paint(wm_widget_t *wg){
+    draw_rect(wg->x,wg->y,BW,BH,0xAAAAAA);
+    char s[2]={(char)wg->id,0};
+    ui_label(wg, s, 0x000000);
+}
 
-    int winw=300, winh=350;
-    int wx=(framebuffer_width-winw)/2;
-    int wy=(framebuffer_height-winh)/2;
+// keys only change the expression; the display repaints on the next compose
+static void calc_key_click(wm_widget_t *wg,int x,int y){
+    (void)x; (void)y;
+    char k = (char)wg->id;
+    if(k=='C') calc_clear();
+    else if(k=='=') calc_eval();
+    else            calc_add(k);
+    wm_invalidate(&calc_display);
+}
 
-    draw_rounded(wx,wy,winw,winh,15,0xBBBBBB);
-    draw_rect(wx+10,wy+10,winw-20,60,0xFFFFFF);
+static void calculator_ui(void){
+    if(calc_win){ wm_raise(calc_win); return; }
+    calc_win = wm_create(((int)framebuffer_width-CALC_W)/2, ((int)framebuffer_height-CALC_H)/2,
+                         CALC_W, CALC_H, 0, "Calculator", 0xBBBBBB);
+    if(!calc_win) return;
 
-    // close button
-    int cx=wx+winw-30, cy=wy+10, cw=20, ch=20;
-    draw_rect(cx,cy,cw,ch,0xFF0000);
-    draw_string(cx+5,cy+2,"X",0xFFFFFF);
+    calc_display.x = 10; calc_display.y = DISP_Y; calc_display.w = CALC_W-20; calc_display.h = 60;
+    calc_display.paint = calc_display_paint;
+    calc_display.click = 0;
+    wm_add_widget(calc_win, &calc_display);
 
     // keys
-    const char *keys="789/456*123-0.=+C";
     int idx=0;
     for(int r=0;r<4;r++){
         for(int c=0;c<4;c++){
-            char k=keys[idx++];
-            int bx=wx+10+c*(BW+5);
-            int by=wy+80+r*(BH+5);
-            draw_key(bx,by,k);
-        }
-    }
-
-    // show cursor at current pos
-    cursor_move_to(cur_x,cur_y);
-
-    while(1){
-        if (rtl8139_is_ready()) rtl8139_poll();
-
-        // refresh display area (expression)
-        draw_rect(wx+12,wy+12,winw-24,56,0xFFFFFF);
-        draw_string(wx+20,wy+32,expr,0x000000);
-
-        int dx, dy; unsigned char btn;
-        if(mouse_read_packet(&dx,&dy,&btn)){
-            cursor_move_to(cur_x+dx, cur_y+dy);
-
-            if(btn & 1){
-                // close
-                if(cur_x>cx && cur_x<cx+cw && cur_y>cy && cur_y<cy+ch) {
-                    cursor_restore_under();
-                    return;
-                }
-                // keys
-                idx=0;
-                for(int rr=0;rr<4;rr++){
-                    for(int cc=0;cc<4;cc++){
-                        char k=keys[idx++];
-                        int bx=wx+10+cc*(BW+5);
-                        int by=wy+80+rr*(BH+5);
-                        if(cur_x>bx && cur_x<bx+BW && cur_y>by && cur_y<by+BH){
-                            if(k=='C') calc_clear();
-                            else if(k=='=') calc_eval();
-                            else            calc_add(k);
-                        }
-                    }
-                }
-            }
+            wm_widget_t *wg = &calc_key_widgets[idx];
+            wg->x = 10+c*(BW+5);
+            wg->y = KEYS_Y+r*(BH+5);
+            wg->w = BW; wg->h = BH;
+            wg->id = calc_keys[idx++];
+            wg->paint = calc_key_paint;
+            wg->click = calc_key_click;
+            wm_add_widget(calc_win, wg);
         }
     }
 }
@@ -432,43 +431,151 @@ static int parse_url(const char *url, char *host_buf, int host_buf_size, const c
 }
 
 
-static void browser_ui(void){
-    // redraw desktop bg
-    draw_rect(0,0,framebuffer_width,framebuffer_height,0x87CEEB);
+static const char *browser_url = "http://jsonplaceholder.typicode.com/posts/2";
+static char browser_body[8192];
+static int  browser_got = 0;          // >0: body is valid
+static char browser_msg[128];
+static u32  browser_msg_color = 0;
+static wm_widget_t browser_addr, browser_content, browser_sbar;
 
-    const int ww=600, wh=400;
-    const int wx=(framebuffer_width - ww)/2;
-    const int wy=(framebuffer_height - wh)/2;
+static void browser_addr_paint(wm_widget_t *wg){
+    draw_rect(wg->x,wg->y,wg->w,wg->h,0xDDDDDD);
+    draw_string(wg->x+6,wg->y+5,browser_url,0x000000);
+}
 
-    // window frame
-    draw_rounded(wx,wy,ww,wh,12,0xCCCCCC);
+/* Content viewport: the body is indexed once into display lines (split at
+ * newlines, wrapped at the viewport width, leading blanks dropped). A
+ * scroll moves the pixels already on screen and draws only the lines that
+ * came into view. */
+#define BROWSER_MAX_LINES 2048
+#define LINE_H  10
+#define SBAR_W  16
+static struct { u16 start, len; } browser_line[BROWSER_MAX_LINES];
+static int browser_nlines = 0, browser_top = 0;
+
+static int browser_rows(void){ return (browser_content.h - 16) / LINE_H; }
+
+static void browser_index(void){
+    int cols = (browser_content.w - 12) / 8;
+    const char *p = browser_body;
+    browser_nlines = 0;
+    browser_top = 0;
+    while (*p && browser_nlines < BROWSER_MAX_LINES) {
+        while (*p == ' ') p++;
+        int n = 0;
+        while (p[n] && p[n] != '\n' && n < cols) n++;
+        browser_line[browser_nlines].start = (u16)(p - browser_body);
+        browser_line[browser_nlines].len = (u16)n;
+        browser_nlines++;
+        p += n;
+        if (*p == '\n') p++;
+    }
+}
 
-    // title bar
-    const int tb_h=30;
-    draw_rect(wx,wy,ww,tb_h,0x1E90FF);
-    draw_string(wx+10, wy+8, "TBHCR Browser", 0xFFFFFF);
+// one viewport row; the target must be the browser surface
+static void browser_draw_row(int r){
+    const wm_widget_t *wg = &browser_content;
+    int y = wg->y + 8 + r*LINE_H;
+    draw_rect(wg->x, y, wg->w, LINE_H, 0xFFFFFF);
+    int i = browser_top + r;
+    if (i < browser_nlines)
+        draw_string_n(wg->x+6, y, browser_body + browser_line[i].start, browser_line[i].len, 0x000000);
+}
 
-    // close button
-    const int cx=wx+ww-26, cy=wy+5, cw=20, ch=20;
-    draw_rect(cx,cy,cw,ch,0xFF0000);
-    draw_string(cx+5,cy+2,"X",0xFFFFFF);
+// the fetched body, or the status message while there is none
+static void browser_content_paint(wm_widget_t *wg){
+    draw_rect(wg->x,wg->y,wg->w,wg->h,0xFFFFFF);
+    if (browser_got <= 0) {
+        draw_string(wg->x+6, wg->y+8, browser_msg, browser_msg_color);
+        return;
+    }
+    for (int r = 0; r < browser_rows(); r++) browser_draw_row(r);
+}
 
-    // address bar
-    const int ab_x=wx+10, ab_y=wy+tb_h+8, ab_w=ww-20, ab_h=24;
-    draw_rect(ab_x,ab_y,ab_w,ab_h,0xDDDDDD);
-    const char *url = "http://jsonplaceholder.typicode.com/posts/2";
-    draw_string(ab_x+6,ab_y+5,url,0x000000);
+static void browser_sbar_paint(wm_widget_t *wg){
+    draw_rect(wg->x, wg->y, wg->w, wg->h, 0xE8E8E8);
+    draw_rect(wg->x, wg->y, wg->w, SBAR_W, 0xAAAAAA);
+    draw_string(wg->x+4, wg->y+4, "^", 0x000000);
+    draw_rect(wg->x, wg->y+wg->h-SBAR_W, wg->w, SBAR_W, 0xAAAAAA);
+    draw_string(wg->x+4, wg->y+wg->h-SBAR_W+4, "v", 0x000000);
+    int rows = browser_rows(), track = wg->h - 2*SBAR_W;
+    if (browser_nlines > rows) {
+        int th = track * rows / browser_nlines;
+        if (th < 8) th = 8;
+        int ty = (track - th) * browser_top / (browser_nlines - rows);
+        draw_rect(wg->x+2, wg->y+SBAR_W+ty, wg->w-4, th, 0x888888);
+    }
+}
 
-    // content area
-    const int ct_x=wx+10, ct_y=ab_y+ab_h+8, ct_w=ww-20, ct_h=wh - (tb_h+8+ab_h+8+12);
-    draw_rect(ct_x,ct_y,ct_w,ct_h,0xFFFFFF);
+static void browser_scroll(int delta){
+    int rows = browser_rows();
+    int top = clampi(browser_top + delta, 0, browser_nlines > rows ? browser_nlines - rows : 0);
+    delta = top - browser_top;
+    if (!delta) return;
+    browser_top = top;
+
+    gfx_surface_t *prev = gfx_set_target(&browser_win->surf);
+    int r0 = 0, r1 = rows;   // rows that need drawing
+    if (delta > -rows && delta < rows) {
+        gfx_scroll(browser_content.x, browser_content.y+8, browser_content.w, rows*LINE_H, -delta*LINE_H);
+        if (delta > 0) r0 = rows - delta;
+        else           r1 = -delta;
+    }
+    for (int r = r0; r < r1; r++) browser_draw_row(r);
+    gfx_set_target(prev);
+    wm_invalidate(&browser_sbar);
+}
 
-    // initially show placeholder
-    draw_string(ct_x+6,ct_y+8,"Fetching...",0x000000);
+// arrows scroll 3 lines, the track above/below the thumb a page
+static void browser_sbar_click(wm_widget_t *wg,int x,int y){
+    (void)x;
+    int rows = browser_rows();
+    if (browser_got <= 0) return;
+    if (y < SBAR_W) browser_scroll(-3);
+    else if (y >= wg->h - SBAR_W) browser_scroll(3);
+    else if (browser_nlines > rows) {
+        int track = wg->h - 2*SBAR_W;
+        int mid = SBAR_W + (track - track*rows/browser_nlines) * browser_top / (browser_nlines - rows);
+        browser_scroll(y < mid ? -(rows-1) : rows-1);
+    }
+}
 
-    // Cursor
-    cursor_move_to(cur_x,cur_y);
+static void browser_ui(void){
+    if(browser_win){ wm_raise(browser_win); return; }
+    const int ww=600, wh=400;
+    browser_win = wm_create(((int)framebuffer_width - ww)/2, ((int)framebuffer_height - wh)/2,
+                            ww, wh, 0, "TBHCR Browser", 0xCCCCCC);
+    if(!browser_win) return;
+    const int tb_h=WM_TITLE_H;
 
+    // address bar
+    const int ab_x=10, ab_y=tb_h+8, ab_w=ww-20, ab_h=24;
+    browser_addr.x=ab_x; browser_addr.y=ab_y; browser_addr.w=ab_w; browser_addr.h=ab_h;
+    browser_addr.paint = browser_addr_paint;
+    browser_addr.click = 0;
+    wm_add_widget(browser_win, &browser_addr);
+
+    // content area with a scroll bar on its right, initially a placeholder
+    browser_content.x=10; browser_content.y=ab_y+ab_h+8;
+    browser_content.w=ww-20-SBAR_W; browser_content.h=wh - (tb_h+8+ab_h+8+12);
+    browser_content.paint = browser_content_paint;
+    browser_content.click = 0;
+    wm_add_widget(browser_win, &browser_content);
+    browser_sbar.x=browser_content.x+browser_content.w; browser_sbar.y=browser_content.y;
+    browser_sbar.w=SBAR_W; browser_sbar.h=browser_content.h;
+    browser_sbar.paint = browser_sbar_paint;
+    browser_sbar.click = browser_sbar_click;
+    wm_add_widget(browser_win, &browser_sbar);
+    browser_nlines = browser_top = 0;
+    browser_got = 0;
+    snprintf(browser_msg, sizeof(browser_msg), "Fetching...");
+    browser_msg_color = 0x000000;
+
+    // show the frame before blocking on the network
+    wm_compose();
+    gfx_flush();
+
+    const char *url = browser_url;
     // --- perform HTTP fetch once when browser opens ---
     char host[128];
     const char *path;
@@ -481,7 +588,6 @@ static void browser_ui(void){
         dns_ok = dns_resolve(host, &resolved_ip);
     }
 
-    static char bodybuf[8192];
     int got = 0;
     if (dns_ok) {
         char host_port[256];
@@ -501,97 +607,100 @@ static void browser_ui(void){
         memcpy(host_port + host_len + 1, p, port_len);
         host_port[host_len + 1 + port_len] = 0;
 
-        got = http_get_by_ip_port(resolved_ip, port, host_port, path, bodybuf, sizeof(bodybuf));
+        got = http_get_by_ip_port(resolved_ip, port, host_port, path, browser_body, sizeof(browser_body));
     }
 
 
     // If plain HTTP failed but IP resolved, try HTTPS (if your server supports it)
     if (got <= 0 && resolved_ip != 0) {
-        int tgot = tls_http_get_by_ip(resolved_ip, host, path, bodybuf, sizeof(bodybuf));
+        int tgot = tls_http_get_by_ip(resolved_ip, host, path, browser_body, sizeof(browser_body));
         if (tgot > 0) {
             got = tgot;
         }
     }
 
-    // redraw content area with result (truncate sensibly)
-    draw_rect(ct_x,ct_y,ct_w,ct_h,0xFFFFFF);
-
+    // hand the result to the content widget; it repaints on the next compose
+    browser_got = got;
     if (got > 0) {
-        int max_lines = (ct_h - 16) / 10;
-        int line = 0;
-        char* p = bodybuf;
-        while (line < max_lines && *p) {
-            char tmp[128]; int ti = 0;
-            // copy up to line width or newline
-            while (*p && *p != '\n' && ti < (int)sizeof(tmp)-1) tmp[ti++] = *p++;
-            tmp[ti] = '\0';
-            if (*p == '\n') p++;
-            // trim leading spaces if too long
-            int start = 0; while (tmp[start] == ' ' && start < ti) start++;
-            draw_string(ct_x+6, ct_y+8 + line*10, tmp + start, 0x000000);
-            line++;
-            if (line >= max_lines) break;
-        }
-        if (*p) draw_string(ct_x+6, ct_y + ct_h - 18, "...(truncated)", 0x555555);
+        browser_body[got < (int)sizeof(browser_body) ? got : (int)sizeof(browser_body)-1] = 0;
+        browser_index();
     } else {
-        char dbg_buf[128];
-        snprintf(dbg_buf, sizeof(dbg_buf), "Fetch failed! dns_ok=%d, resolved_ip=%u, got=%d", dns_ok, resolved_ip, got);
-        draw_string(ct_x+6, ct_y+8, dbg_buf, 0xFF0000);
+        snprintf(browser_msg, sizeof(browser_msg), "Fetch failed! dns_ok=%d, resolved_ip=%u, got=%d", dns_ok, resolved_ip, got);
+        browser_msg_color = 0xFF0000;
     }
+    wm_invalidate(&browser_content);
+    wm_invalidate(&browser_sbar);
+}
 
-    // Cursor placed after drawing
-    cursor_move_to(cur_x,cur_y);
-
-    while(1){
-        if (rtl8139_is_ready()) rtl8139_poll();
-
-        int dx, dy; unsigned char btn;
-        if(mouse_read_packet(&dx,&dy,&btn)){
-            cursor_move_to(cur_x+dx, cur_y+dy);
-
-            if(btn & 1){ // close
-                if(cur_x>cx && cur_x<cx+cw && cur_y>cy && cur_y<cy+ch){
-                    cursor_restore_under();
-                    return;
-                }
+/* ===========================================================
+JSON VIEWER
+===========================================================*/
+static char json_body[8192];
+static int  json_got = 0;             // >0: body is valid, its length
+static char json_msg[128];
+static u32  json_msg_color = 0;
+static wm_widget_t json_content;
+
+// key/value pairs of the fetched object, or the status message
+static void json_content_paint(wm_widget_t *wg){
+    const int ct_x=wg->x, ct_y=wg->y, ct_h=wg->h;
+    draw_rect(wg->x,wg->y,wg->w,wg->h,0xFFFFFF);
+    if (json_got <= 0) {
+        draw_string(ct_x+6, ct_y+8, json_msg, json_msg_color);
+        return;
+    }
+    jsmn_parser p;
+    jsmntok_t t[128];
+    jsmn_init(&p);
+    int r = jsmn_parse(&p, json_body, json_got, t, 128);
+    if (r < 0) {
+        draw_string(ct_x+6, ct_y+8, "Failed to parse JSON", 0xFF0000);
+    } else {
+        int line = 0;
+        int max_lines = (ct_h - 16) / 10;
+        for (int i = 1; i < r; i++) {
+            if (t[i].type == JSMN_STRING && t[i-1].type == JSMN_STRING) {
+                char key[64];
+                char val[64];
+                char line_buf[128];
+                int key_len = t[i-1].end - t[i-1].start;
+                int val_len = t[i].end - t[i].start;
+                if (key_len > 63) key_len = 63;
+                if (val_len > 63) val_len = 63;
+                memcpy(key, json_body + t[i-1].start, key_len);
+                key[key_len] = 0;
+                memcpy(val, json_body + t[i].start, val_len);
+                val[val_len] = 0;
+                snprintf(line_buf, sizeof(line_buf), "%s: %s", key, val);
+                draw_string(ct_x+6, ct_y+8 + line*10, line_buf, 0x000000);
+                line++;
+                if (line >= max_lines) break;
             }
         }
     }
 }
 
-/* ===========================================================
-JSON VIEWER
-===========================================================*/
 static void json_viewer_ui(void){
-    // redraw desktop bg
-    draw_rect(0,0,framebuffer_width,framebuffer_height,0x87CEEB);
-
+    if(json_win){ wm_raise(json_win); return; }
     const int ww=600, wh=400;
-    const int wx=(framebuffer_width - ww)/2;
-    const int wy=(framebuffer_height - wh)/2;
-
-    // window frame
-    draw_rounded(wx,wy,ww,wh,12,0xCCCCCC);
-
-    // title bar
-    const int tb_h=30;
-    draw_rect(wx,wy,ww,tb_h,0x1E90FF);
-    draw_string(wx+10, wy+8, "JSON Viewer", 0xFFFFFF);
-
-    // close button
-    const int cx=wx+ww-26, cy=wy+5, cw=20, ch=20;
-    draw_rect(cx,cy,cw,ch,0xFF0000);
-    draw_string(cx+5,cy+2,"X",0xFFFFFF);
-
-    // content area
-    const int ct_x=wx+10, ct_y=wy+tb_h+8, ct_w=ww-20, ct_h=wh - (tb_h+8+12);
-    draw_rect(ct_x,ct_y,ct_w,ct_h,0xFFFFFF);
-
-    // initially show placeholder
-    draw_string(ct_x+6,ct_y+8,"Fetching...",0x000000);
-
-    // Cursor
-    cursor_move_to(cur_x,cur_y);
+    json_win = wm_create(((int)framebuffer_width - ww)/2, ((int)framebuffer_height - wh)/2,
+                         ww, wh, 0, "JSON Viewer", 0xCCCCCC);
+    if(!json_win) return;
+    const int tb_h=WM_TITLE_H;
+
+    // content area, initially showing a placeholder
+    json_content.x=10; json_content.y=tb_h+8;
+    json_content.w=ww-20; json_content.h=wh - (tb_h+8+12);
+    json_content.paint = json_content_paint;
+    json_content.click = 0;
+    wm_add_widget(json_win, &json_content);
+    json_got = 0;
+    snprintf(json_msg, sizeof(json_msg), "Fetching...");
+    json_msg_color = 0x000000;
+
+    // show the frame before blocking on the network
+    wm_compose();
+    gfx_flush();
 
     // --- perform HTTP fetch once when browser opens ---
     const char *url = "http://jsonplaceholder.typicode.com/users/1";
@@ -606,7 +715,6 @@ static void json_viewer_ui(void){
         dns_ok = dns_resolve(host, &resolved_ip);
     }
 
-    static char bodybuf[8192];
     int got = 0;
     if (dns_ok) {
         char host_port[256];
@@ -626,66 +734,16 @@ static void json_viewer_ui(void){
         memcpy(host_port + host_len + 1, p, port_len);
         host_port[host_len + 1 + port_len] = 0;
 
-        got = http_get_by_ip_port(resolved_ip, port, host_port, path, bodybuf, sizeof(bodybuf));
-    }
-
-    // redraw content area with result (truncate sensibly)
-    draw_rect(ct_x,ct_y,ct_w,ct_h,0xFFFFFF);
-
-    if (got > 0) {
-        jsmn_parser p;
-        jsmntok_t t[128];
-        jsmn_init(&p);
-        int r = jsmn_parse(&p, bodybuf, strlen(bodybuf), t, 128);
-        if (r < 0) {
-            draw_string(ct_x+6, ct_y+8, "Failed to parse JSON", 0xFF0000);
-        } else {
-            int line = 0;
-            int max_lines = (ct_h - 16) / 10;
-            for (int i = 1; i < r; i++) {
-                if (t[i].type == JSMN_STRING && t[i-1].type == JSMN_STRING) {
-                    char key[64];
-                    char val[64];
-                    char line_buf[128];
-                    int key_len = t[i-1].end - t[i-1].start;
-                    int val_len = t[i].end - t[i].start;
-                    if (key_len > 63) key_len = 63;
-                    if (val_len > 63) val_len = 63;
-                    memcpy(key, bodybuf + t[i-1].start, key_len);
-                    key[key_len] = 0;
-                    memcpy(val, bodybuf + t[i].start, val_len);
-                    val[val_len] = 0;
-                    snprintf(line_buf, sizeof(line_buf), "%s: %s", key, val);
-                    draw_string(ct_x+6, ct_y+8 + line*10, line_buf, 0x000000);
-                    line++;
-                    if (line >= max_lines) break;
-                }
-            }
-        }
-    } else {
-        char dbg_buf[128];
-        snprintf(dbg_buf, sizeof(dbg_buf), "Fetch failed! dns_ok=%d, resolved_ip=%u, got=%d", dns_ok, resolved_ip, got);
-        draw_string(ct_x+6, ct_y+8, dbg_buf, 0xFF0000);
+        got = http_get_by_ip_port(resolved_ip, port, host_port, path, json_body, sizeof(json_body));
     }
 
-    // Cursor placed after drawing
-    cursor_move_to(cur_x,cur_y);
-
-    while(1){
-        if (rtl8139_is_ready()) rtl8139_poll();
-
-        int dx, dy; unsigned char btn;
-        if(mouse_read_packet(&dx,&dy,&btn)){
-            cursor_move_to(cur_x+dx, cur_y+dy);
-
-            if(btn & 1){ // close
-                if(cur_x>cx && cur_x<cx+cw && cur_y>cy && cur_y<cy+ch){
-                    cursor_restore_under();
-                    return;
-                }
-            }
-        }
+    // hand the result to the content widget; it repaints on the next compose
+    json_got = got;
+    if (got <= 0) {
+        snprintf(json_msg, sizeof(json_msg), "Fetch failed! dns_ok=%d, resolved_ip=%u, got=%d", dns_ok, resolved_ip, got);
+        json_msg_color = 0xFF0000;
     }
+    wm_invalidate(&json_content);
 }
 
 /* Tiny early UART init so COM1 is usable very early in boot.
@@ -718,14 +776,62 @@ static void serial_early_puts(const char *s){
     }
 }
 
+static void serial_early_putdec(u32 v){
+    char b[11]; int n = 0;
+    do { b[n++] = '0' + v%10; v /= 10; } while(v);
+    char s[12]; int i = 0;
+    while(n) s[i++] = b[--n];
+    s[i] = 0;
+    serial_early_puts(s);
+}
+
+static void log_memory(void){
+    pmm_stats_t ps; heap_stats_t hs;
+    pmm_stats(&ps);
+    heap_stats(&hs);
+    serial_early_puts("mem: ");
+    serial_early_putdec(ps.total_frames/256);
+    serial_early_puts(" MiB usable, ");
+    serial_early_putdec(ps.free_frames/256);
+    serial_early_puts(" MiB free, heap ");
+    serial_early_putdec(hs.size >> 20);
+    serial_early_puts(" MiB\n");
+}
+
 /* ===========================================================
 kmain
 ===========================================================*/
 void kmain(unsigned magic,unsigned addr){
     (void)magic;
     uart_init_early();
+    /* x87 + SSE with lazy state switching (#NM), before anything checks
+     * for SSE */
+    fpu_init();
+    /* memcpy/memset/memmove: enhanced rep movsb/stosb when the CPU has
+     * them (the microcode also streams big copies past the cache), else
+     * the SSE2 loops with non-temporal stores for big copies, else plain
+     * rep movsd/stosd */
+    if (cpu_has_erms())          string_set_impl(STRING_ERMS);
+    else if (cpu_sse2_usable())  string_set_impl(STRING_SSE2);
+    /* and SSE2 for the long strlen/memchr/strchr/memmem scans */
+    string_set_simd(cpu_sse2_usable());
+    /* and for packet checksums (csum.h is pulled in through endian.h) */
+    csum_set_simd(cpu_sse2_usable());
     /* Emit a short serial boot banner to help diagnose -serial stdio visibility */
     serial_early_puts("serial: kernel start\n");
+    /* The clock every timeout and delay is measured with: TSC rate from
+     * the PIT, before any driver waits on hardware */
+    ktime_init();
+    if (ktime_tsc_khz()) {
+        serial_early_puts("ktime: TSC ");
+        serial_early_putdec(ktime_tsc_khz() / 1000);
+        serial_early_puts(ktime_tsc_invariant() ? " MHz, invariant\n" : " MHz, not invariant\n");
+    } else serial_early_puts("ktime: no TSC, counting PIT ticks\n");
+    /* Page frames from the multiboot memory map, then the heap on top of
+     * them: nothing may kmalloc before this point */
+    pmm_init((void*)addr);
+    heap_init();
+    log_memory();
     /* Probe xHCI early and always so we get controller/port logs on serial even
      * when a PCI NIC is present. These extern declarations reference the
      * implementations in usb/xhci.c. */
@@ -737,6 +843,20 @@ void kmain(unsigned magic,unsigned addr){
     /* Attempt a simple enumerate (may be dry-run depending on xhci_hw_enable) */
     xhci_enumerate_once();
     init_graphics((void*)addr);
+    if(psf_from_multiboot((void*)addr, &boot_font) == 0) ui_font = &boot_font;
+    wm_set_font(ui_font);
+    /* Tear-free page flipping when running on Bochs/QEMU std VGA */
+    bga_init();
+    /* Flat identity map; the framebuffer is then switched to write-combining
+     * so flushes stream through the WC buffers instead of going uncached. */
+    paging_init();
+    if (framebuffer_addr)
+        paging_set_cache(framebuffer_addr, gfx_vram_size(), PG_CACHE_WC);
+    /* Under QEMU with a virtio-gpu, scan out from a host resource and only
+     * transfer damaged rects (runs after the WC mapping: its backing is RAM) */
+    virtio_gpu_init();
+    /* SSE2 blend kernels when the CPU has them and SSE state is enabled */
+    gfx_set_simd(cpu_sse2_usable());
     init_mouse();
 
     // Bring up NIC + set IP (QEMU slirp defaults)
@@ -813,23 +933,10 @@ void kmain(unsigned magic,unsigned addr){
         draw_string(20, 20, "NIC: usb_stub enabled (test frame injected)", 0xFFD700);
     }
 
-    // Start with cursor at center (save & draw once)
+    // Start with cursor at center (drawn by the next flush)
     cursor_move_to((int)framebuffer_width/2,(int)framebuffer_height/2);
 
     if(show_welcome()){
-        while(1){
-            if (rtl8139_is_ready()) {
-                rtl8139_poll();
-            }
-
-            int app = show_desktop();
-            if(app==1){
-                calculator_ui();
-            }else if(app==2){
-                browser_ui();
-            }else if(app==3){
-                json_viewer_ui();
-            }
-        }
+        show_desktop();   // never returns
     }
 }
@@ -0,0 +1,105 @@
+// ktime.c — monotonic clock: TSC calibrated against PIT channel 2
+#include "ktime.h"
+#include "cpu.h"
+#include "io.h"
+
+/* PIT channel 2 raises no interrupt and its gate and output are reachable
+ * through port 0x61, so it times the calibration: the TSC is read around a
+ * CAL_MS one-shot countdown, CAL_RUNS times, and the shortest run wins (a
+ * longer one was disturbed, by SMM or the host). Counts become ns through
+ * a 32.32 fixed-point factor worked out once at init, so ktime_ns() is a
+ * few multiplies and no division. Without a TSC the channel runs free
+ * instead and ktime_ns() adds up its ticks; that only keeps time while it
+ * is read at least once per 55 ms wrap, which the polling waits do. HPET
+ * would need the ACPI tables, which nothing parses yet. */
+#define PIT_HZ    1193182u
+#define PIT_CMD   0x43
+#define PIT_CH2   0x42
+#define PIT_PORTB 0x61              // bit 0 ch2 gate, bit 1 speaker, bit 5 ch2 output
+#define CAL_MS    10
+#define CAL_RUNS  3
+
+static int ready, invariant;
+static u32 tsc_khz;
+static u64 base;                    // TSC at ktime_init
+static u32 mult_int, mult_frac;     // ns per count, 32.32
+static u64 pit_ticks;
+static u16 pit_last;
+
+static void set_rate(u64 hz){
+    u64 m = (1000000000ull << 32) / hz;
+    mult_int = (u32)(m >> 32);
+    mult_frac = (u32)m;
+}
+
+static u64 scale(u64 c){
+    return c * mult_int + (u64)(u32)(c >> 32) * mult_frac + (((u64)(u32)c * mult_frac) >> 32);
+}
+
+// TSC cycles while channel 2 counts `ticks` down in mode 0; 0 if it never ends
+static u64 tsc_over_pit(u16 ticks){
+    outb(PIT_PORTB, (inb(PIT_PORTB) & ~0x02) | 0x01);
+    outb(PIT_CMD, 0xB0);                        // ch2, lo/hi byte, mode 0
+    outb(PIT_CH2, ticks & 0xFF);
+    outb(PIT_CH2, ticks >> 8);
+    u64 t0 = rdtsc();
+    for(u32 n=0; !(inb(PIT_PORTB) & 0x20); n++)
+        if(n > 1000000) return 0;               // port reads take ~1 us
+    return rdtsc() - t0;
+}
+
+void ktime_init(void){
+    if(ready) return;
+    u32 flags = irq_save();
+    if(cpu_has_tsc()){
+        u16 ticks = (u16)(PIT_HZ * CAL_MS / 1000);
+        u64 best = 0;
+        for(int i=0;i<CAL_RUNS;i++){
+            u64 c = tsc_over_pit(ticks);
+            if(c && (!best || c < best)) best = c;
+        }
+        if(best){
+            tsc_khz = (u32)(best * PIT_HZ / ((u64)ticks * 1000));
+            invariant = cpu_has_invariant_tsc();
+        }
+    }
+    if(tsc_khz){
+        set_rate((u64)tsc_khz * 1000);
+        base = rdtsc();
+    }else{
+        outb(PIT_PORTB, (inb(PIT_PORTB) & ~0x02) | 0x01);
+        outb(PIT_CMD, 0xB4);                    // ch2, lo/hi byte, mode 2, reload 65536
+        outb(PIT_CH2, 0);
+        outb(PIT_CH2, 0);
+        pit_last = 0;
+        set_rate(PIT_HZ);
+    }
+    ready = 1;
+    irq_restore(flags);
+}
+
+u64 ktime_ns(void){
+    if(!ready) ktime_init();
+    if(tsc_khz) return scale(rdtsc() - base);
+    u32 flags = irq_save();
+    outb(PIT_CMD, 0x80);                        // latch ch2
+    u16 now = inb(PIT_CH2);
+    now |= (u16)(inb(PIT_CH2) << 8);
+    pit_ticks += (u16)(pit_last - now);         // counts down
+    pit_last = now;
+    u64 ns = scale(pit_ticks);
+    irq_restore(flags);
+    return ns;
+}
+
+u32 ktime_tsc_khz(void){ if(!ready) ktime_init(); return tsc_khz; }
+int ktime_tsc_invariant(void){ if(!ready) ktime_init(); return invariant; }
+
+void udelay(u32 us){
+    deadline_t d = ktime_deadline_us(us);
+    while(!ktime_expired(d)) asm volatile("pause");
+}
+
+void mdelay(u32 ms){
+    while(ms--) udelay(1000);
+}
@@ -0,0 +1,23 @@
+#ifndef KTIME_H
+#define KTIME_H
+
+#include "common.h"
+
+// Monotonic time since ktime_init(), from the TSC calibrated against the
+// PIT (or, without a TSC, the PIT itself). ktime_init() runs on first use
+// if kmain has not called it yet.
+typedef u64 deadline_t;             // a ktime_ns() value
+
+void ktime_init(void);
+u64  ktime_ns(void);
+u32  ktime_tsc_khz(void);           // 0: no TSC, time comes from the PIT
+int  ktime_tsc_invariant(void);
+
+void udelay(u32 us);                // busy-wait, at least us microseconds
+void mdelay(u32 ms);
+
+static inline deadline_t ktime_deadline_us(u32 us){ return ktime_ns() + (u64)us * 1000u; }
+static inline deadline_t ktime_deadline_ms(u32 ms){ return ktime_ns() + (u64)ms * 1000000u; }
+static inline int ktime_expired(deadline_t d){ return ktime_ns() >= d; }
+
+#endif
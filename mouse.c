@@ -1,14 +1,18 @@
 #include "io.h"
 #include "graphics.h"
 #include "mouse.h"
+#include "ktime.h"
 
 int mouse_x = 100, mouse_y = 100;
 
+// the controller answers within microseconds; give up after 50 ms
 static void mouse_wait_read(){
-    while (!(inb(0x64) & 1));
+    deadline_t end = ktime_deadline_ms(50);
+    while (!(inb(0x64) & 1) && !ktime_expired(end));
 }
 static void mouse_wait_write(){
-    while  (inb(0x64) & 2);
+    deadline_t end = ktime_deadline_ms(50);
+    while  ((inb(0x64) & 2) && !ktime_expired(end));
 }
 
 static void mouse_write(unsigned char val){
@@ -16,6 +16,35 @@ typedef struct multiboot_tag_string {
     char string[0];
 } multiboot_tag_string_t;
 
+typedef struct multiboot_tag_module {
+    u32 type;
+    u32 size;
+    u32 mod_start;
+    u32 mod_end;
+    char cmdline[0];
+} multiboot_tag_module_t;
+
+typedef struct multiboot_mmap_entry {
+    u64 addr;
+    u64 len;
+    u32 type;           // MULTIBOOT_MEMORY_*
+    u32 zero;
+} __attribute__((packed)) multiboot_mmap_entry_t;
+
+typedef struct multiboot_tag_mmap {
+    u32 type;
+    u32 size;
+    u32 entry_size;     // step between entries, may exceed sizeof(entry)
+    u32 entry_version;
+    multiboot_mmap_entry_t entries[0];
+} multiboot_tag_mmap_t;
+
+#define MULTIBOOT_MEMORY_AVAILABLE        1
+#define MULTIBOOT_MEMORY_RESERVED         2
+#define MULTIBOOT_MEMORY_ACPI_RECLAIMABLE 3
+#define MULTIBOOT_MEMORY_NVS              4
+#define MULTIBOOT_MEMORY_BADRAM           5
+
 typedef struct multiboot_tag_framebuffer {
     u32 type;
     u32 size;
@@ -25,7 +54,14 @@ typedef struct multiboot_tag_framebuffer {
     u32 framebuffer_height;
     u8 framebuffer_bpp;
     u8 framebuffer_type;
-    u8 reserved[6];
+    u16 reserved;
+    // color info, valid for framebuffer_type == 1 (direct RGB)
+    u8 red_field_position;
+    u8 red_mask_size;
+    u8 green_field_position;
+    u8 green_mask_size;
+    u8 blue_field_position;
+    u8 blue_mask_size;
 } __attribute__((packed)) multiboot_tag_framebuffer_t;
 
 typedef struct multiboot_tag_vbe {
@@ -5,6 +5,7 @@
 #include <stddef.h>
 #include <stdint.h>
 #include "endian.h"
+#include "csum.h"
 #include "dns.h"
 #include "tcp.h"
 #include "stdio.h"
@@ -170,15 +171,35 @@ void net_rx(const uint8_t *frame,int len){
 
 /* --- SEND helpers --- */
 
-/* send an L4 payload as an IPv4 packet (proto set by caller) */
-void net_send_ip(uint32_t dst_ip, uint8_t proto,
-                 const uint8_t *payload, int payload_len)
+/* L4 header + payload into dst, the payload copied once; with csum_off >= 0
+ * the checksum is summed on the way (sum: pseudo header + header, see
+ * csum.h) and stored in the header copy at csum_off */
+static int l4_build(uint8_t *dst, uint8_t proto, const void *hdr, int hdr_len,
+                    int csum_off, uint32_t sum, const void *payload, int payload_len)
+{
+    memcpy(dst, hdr, (size_t)hdr_len);
+    if (csum_off < 0) {
+        if (payload_len > 0) memcpy(dst + hdr_len, payload, (size_t)payload_len);
+        return hdr_len + payload_len;
+    }
+    sum = csum_and_copy(dst + hdr_len, payload, payload_len, sum);
+    uint16_t c = csum_fold(sum);
+    if (proto == IP_PROTO_UDP && c == 0) c = 0xFFFF;   /* 0 means "no checksum" */
+    memcpy(dst + csum_off, &c, 2);
+    return hdr_len + payload_len;
+}
+
+/* send an L4 header + payload as an IPv4 packet (proto set by caller) */
+void net_send_l4(uint32_t dst_ip, uint8_t proto, const void *hdr, int hdr_len,
+                 int csum_off, uint32_t sum, const void *payload, int payload_len)
 {
     uint32_t next_hop = dst_ip;
     // if outside subnet, send via gateway
     if (((dst_ip ^ g_netif.ip) & g_netif.netmask) != 0) {
         next_hop = g_netif.gw_ip;
     }
+    if (hdr_len + payload_len > 1500 - (int)sizeof(struct ip_hdr))
+        payload_len = 1500 - (int)sizeof(struct ip_hdr) - hdr_len;
 
     uint8_t buf[1514]; int off=0;
 
@@ -191,10 +212,8 @@ void net_send_ip(uint32_t dst_ip, uint8_t proto,
             if (pending[i].dst_ip == 0){
                 pending[i].dst_ip = dst_ip;   // still track original dst
                 pending[i].proto = proto;
-                if (payload_len > (int)sizeof(pending[i].payload))
-                    payload_len = (int)sizeof(pending[i].payload);
-                pending[i].payload_len = payload_len;
-                memcpy(pending[i].payload, payload, (size_t)payload_len);
+                pending[i].payload_len = l4_build(pending[i].payload, proto, hdr, hdr_len,
+                                                  csum_off, sum, payload, payload_len);
                 break;
             }
         }
@@ -209,7 +228,7 @@ void net_send_ip(uint32_t dst_ip, uint8_t proto,
     struct ip_hdr *ip=(struct ip_hdr*)(buf+off);
     ip->ver_ihl = 0x45;
     ip->tos = 0;
-    ip->tot_len = htons((uint16_t)(sizeof(*ip) + payload_len));
+    ip->tot_len = htons((uint16_t)(sizeof(*ip) + hdr_len + payload_len));
     ip->id = htons(1);
     ip->frag = 0;
     ip->ttl = 64;
@@ -220,24 +239,32 @@ void net_send_ip(uint32_t dst_ip, uint8_t proto,
     ip->hdr_chksum = ip_checksum(ip, sizeof(*ip));
     off += sizeof(*ip);
 
-    memcpy(buf+off, payload, (size_t)payload_len);
-    off += payload_len;
+    off += l4_build(buf+off, proto, hdr, hdr_len, csum_off, sum, payload, payload_len);
 
     nic_tx(buf, off);
 }
 
+/* send an L4 payload (header included, checksum done) as an IPv4 packet */
+void net_send_ip(uint32_t dst_ip, uint8_t proto,
+                 const uint8_t *payload, int payload_len)
+{
+    net_send_l4(dst_ip, proto, payload, payload_len, -1, 0, NULL, 0);
+}
+
 
 /* convenience UDP builder (kept for your existing code) */
 void net_send_udp_ipv4(uint32_t dst_ip,uint16_t dst_port,uint16_t src_port,
                        const void *payload,int len){
-    uint8_t seg[8 + 1472];
-    struct udp_hdr *u = (struct udp_hdr*)seg;
-    u->src = htons(src_port);
-    u->dst = htons(dst_port);
-    u->len = htons((uint16_t)(8 + len));
-    u->chksum = 0; /* skipping UDP checksum for now */
-    memcpy(seg+8, payload, (size_t)len);
-    net_send_ip(dst_ip, IP_PROTO_UDP, seg, 8+len);
+    struct udp_hdr u;
+    if (len > 1472) len = 1472;
+    u.src = htons(src_port);
+    u.dst = htons(dst_port);
+    u.len = htons((uint16_t)(8 + len));
+    u.chksum = 0;
+    uint32_t sum = csum_pseudo(g_netif.ip, dst_ip, IP_PROTO_UDP, (uint16_t)(8 + len), 0);
+    sum = csum_partial(&u, sizeof(u), sum);
+    net_send_l4(dst_ip, IP_PROTO_UDP, &u, sizeof(u), offsetof(struct udp_hdr, chksum),
+                sum, payload, len);
 }
 
 /* optional: minimal SYN helper */
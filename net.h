@@ -29,6 +29,11 @@ void net_send_udp_ipv4(uint32_t dst_ip, uint16_t dst_port, uint16_t src_port,
 const void *payload, int len);
 
 void net_send_ip(uint32_t dst_ip, uint8_t proto, const uint8_t *payload, int payload_len);
+// header copied as is, payload copied into the frame once; with csum_off >= 0
+// the L4 checksum is finished on the way and stored at csum_off in the
+// header's copy, sum being the partial sum (csum.h) of the pseudo header and the header
+void net_send_l4(uint32_t dst_ip, uint8_t proto, const void *hdr, int hdr_len,
+                 int csum_off, uint32_t sum, const void *payload, int payload_len);
 
 void net_send_udp_ipv4(uint32_t dst_ip, uint16_t dst_port, uint16_t src_port,
                        const void *payload, int len);
@@ -23,7 +23,7 @@ void udp_on_datagram(uint32_t src_ip, uint16_t src_port,
     // Very naive: search for "title"
     char *p = buf;
     int y = 100; // start drawing lower
-    while ((p = strstr(p, "\"title\""))) {
+    while ((p = memmem(p, buf + len - p, "\"title\"", 7))) {
         p = strchr(p, ':');
         if (!p) break;
         p++;
@@ -0,0 +1,150 @@
+// paging.c — flat identity mapping with PSE pages and PAT/MTRR cache control
+#include "paging.h"
+#include "cpu.h"
+#include <stdint.h>
+#include <stddef.h>
+
+#define PG_P        0x001
+#define PG_RW       0x002
+#define PG_PWT      0x008
+#define PG_PCD      0x010
+#define PG_PS       0x080       // PDE: 4 MiB page
+#define PG_PAT_4K   0x080       // PTE: PAT bit
+#define PG_PAT_4M   0x1000      // PDE (PS=1): PAT bit
+
+#define CR0_PG      0x80000000u
+#define CR0_CD      0x40000000u
+#define CR0_NW      0x20000000u
+#define CR4_PSE     0x10
+
+#define MSR_MTRRCAP      0xFE
+#define MSR_PAT          0x277
+#define MSR_MTRR_DEFTYPE 0x2FF
+#define MSR_MTRR_BASE(n) (0x200 + 2*(n))
+#define MSR_MTRR_MASK(n) (0x201 + 2*(n))
+
+#define PT_POOL 16              // 4 KiB page tables available for splitting
+
+static uint32_t page_dir[1024] __attribute__((aligned(4096)));
+static uint32_t page_tables[PT_POOL][1024] __attribute__((aligned(4096)));
+static int pt_used = 0;
+static int have_pat = 0;
+
+/* PAT layout after paging_init: entries 0-3 keep their power-on values so
+ * PWT/PCD mean what they always did; entry 5 (PAT|PWT) becomes WC.
+ *   0 WB  1 WT  2 UC-  3 UC  4 WB  5 WC  6 UC-  7 UC */
+#define PAT_VALUE 0x0007010600070406ULL
+
+// PWT/PCD/PAT bits for a memory type, in 4 KiB PTE layout
+static uint32_t cache_bits(int type){
+    switch(type){
+        case PG_CACHE_WT: return PG_PWT;
+        case PG_CACHE_UC: return PG_PCD | PG_PWT;
+        // without PAT the WC comes from an MTRR: UC- (PCD alone) lets it
+        // through, while strong UC (PCD|PWT) would override it
+        case PG_CACHE_WC: return have_pat ? (PG_PAT_4K | PG_PWT) : PG_PCD;
+        default:          return 0;
+    }
+}
+
+static int mtrr_set_wc(uint32_t base, uint32_t size){
+    uint32_t d;
+    cpuid(1, NULL, NULL, NULL, &d);
+    if(!(d & (1u<<12))) return -1;                // no MTRRs
+    uint64_t cap = rdmsr(MSR_MTRRCAP);
+    if(!(cap & (1u<<10))) return -1;              // WC type not supported
+
+    // variable MTRRs need a power-of-two size aligned to itself
+    uint32_t sz = 4096;
+    while(sz < size && sz < 0x80000000u) sz <<= 1;
+    if(base & (sz-1)) return -1;
+
+    uint32_t maxext, physbits = 36;
+    cpuid(0x80000000, &maxext, NULL, NULL, NULL);
+    if(maxext >= 0x80000008){ uint32_t a; cpuid(0x80000008, &a, NULL, NULL, NULL); physbits = a & 0xFF; }
+    uint64_t physmask = ((1ULL << physbits) - 1) & ~0xFFFULL;
+
+    int vcnt = (int)(cap & 0xFF), slot = -1;
+    for(int i=0;i<vcnt;i++){
+        if(!(rdmsr(MSR_MTRR_MASK(i)) & (1u<<11))){ slot = i; break; }
+    }
+    if(slot < 0) return -1;
+
+    // SDM 11.11.7.2: caches off and flushed while the MTRRs are rewritten
+    uint32_t flags = irq_save();
+    uint32_t cr0 = read_cr0();
+    write_cr0((cr0 | CR0_CD) & ~CR0_NW);
+    wbinvd();
+    uint64_t deftype = rdmsr(MSR_MTRR_DEFTYPE);
+    wrmsr(MSR_MTRR_DEFTYPE, deftype & ~(1u<<11));
+    wrmsr(MSR_MTRR_BASE(slot), (uint64_t)base | 1);   // type 1 = WC
+    wrmsr(MSR_MTRR_MASK(slot), (~(uint64_t)(sz-1) & physmask) | (1u<<11));
+    wbinvd();
+    wrmsr(MSR_MTRR_DEFTYPE, deftype);
+    write_cr0(cr0);
+    irq_restore(flags);
+    return 0;
+}
+
+void paging_init(void){
+    uint32_t d;
+    cpuid(1, NULL, NULL, NULL, &d);
+    if(d & (1u<<16)){
+        wbinvd();
+        wrmsr(MSR_PAT, PAT_VALUE);
+        have_pat = 1;
+    }
+
+    for(uint32_t i=0;i<1024;i++)
+        page_dir[i] = (i << 22) | PG_P | PG_RW | PG_PS;
+
+    write_cr4(read_cr4() | CR4_PSE);
+    write_cr3((uint32_t)(uintptr_t)page_dir);
+    write_cr0(read_cr0() | CR0_PG);
+}
+
+// give the 4 MiB page at index pdi its own page table (same type everywhere)
+static uint32_t *split_pde(uint32_t pdi){
+    if(!(page_dir[pdi] & PG_PS)) return (uint32_t*)(uintptr_t)(page_dir[pdi] & ~0xFFFu);
+    if(pt_used == PT_POOL) return NULL;
+    uint32_t *pt = page_tables[pt_used++];
+    uint32_t pde = page_dir[pdi];
+    uint32_t bits = pde & (PG_PWT | PG_PCD);
+    if(pde & PG_PAT_4M) bits |= PG_PAT_4K;
+    for(uint32_t i=0;i<1024;i++)
+        pt[i] = ((pdi << 22) + (i << 12)) | PG_P | PG_RW | bits;
+    page_dir[pdi] = (uint32_t)(uintptr_t)pt | PG_P | PG_RW;
+    return pt;
+}
+
+int paging_set_cache(uint32_t phys, uint32_t size, int type){
+    if(!size) return 0;
+    if(type == PG_CACHE_WC && !have_pat && mtrr_set_wc(phys, size) != 0) return -1;
+
+    uint32_t bits = cache_bits(type);
+    uint64_t start = phys & ~0xFFFu;
+    uint64_t end = ((uint64_t)phys + size + 0xFFF) & ~0xFFFULL;
+    const uint32_t mask4k = PG_PWT | PG_PCD | PG_PAT_4K;
+
+    while(start < end){
+        uint32_t pdi = (uint32_t)(start >> 22);
+        uint64_t big_end = ((uint64_t)pdi + 1) << 22;
+        if((start & 0x3FFFFF) == 0 && end >= big_end && (page_dir[pdi] & PG_PS)){
+            uint32_t big = (bits & ~PG_PAT_4K) | ((bits & PG_PAT_4K) ? PG_PAT_4M : 0);
+            page_dir[pdi] = (page_dir[pdi] & ~(PG_PWT | PG_PCD | PG_PAT_4M)) | big;
+            start = big_end;
+            continue;
+        }
+        uint32_t *pt = split_pde(pdi);
+        if(!pt) return -1;
+        uint64_t stop = end < big_end ? end : big_end;
+        for(; start < stop; start += 4096){
+            uint32_t pti = (uint32_t)(start >> 12) & 0x3FF;
+            pt[pti] = (pt[pti] & ~mask4k) | bits;
+        }
+    }
+
+    wbinvd();
+    if(read_cr0() & CR0_PG) write_cr3(read_cr3());     // flush TLB
+    return 0;
+}
@@ -0,0 +1,19 @@
+#ifndef PAGING_H
+#define PAGING_H
+
+#include <stdint.h>
+
+// Memory types for paging_set_cache(). WC needs PAT (or a free MTRR).
+#define PG_CACHE_WB 0
+#define PG_CACHE_WT 1
+#define PG_CACHE_UC 2
+#define PG_CACHE_WC 3
+
+// Identity-map the full 4 GiB with 4 MiB pages and turn paging on.
+void paging_init(void);
+
+// Change the memory type of [phys, phys+size). Ranges that do not cover a
+// whole 4 MiB page are split into 4 KiB pages. Returns 0 on success.
+int paging_set_cache(uint32_t phys, uint32_t size, int type);
+
+#endif
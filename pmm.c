@@ -0,0 +1,122 @@
+// pmm.c — physical page frame allocator (one bit per 4 KiB frame)
+#include "pmm.h"
+
+#define MAX_FRAMES (1u << 20)           // 4 GiB
+static u32 bitmap[MAX_FRAMES/32];       // 1 = used
+static u32 nframes = 0;                 // frames covered by the memory map
+static u32 next_hint = 0;               // first word that may have a free bit
+static pmm_stats_t stats;
+
+extern char _kernel_start[], _kernel_end[];   // linker.ld
+
+static inline int  used(u32 f){ return bitmap[f >> 5] >> (f & 31) & 1; }
+static inline void set(u32 f){ bitmap[f >> 5] |= 1u << (f & 31); }
+static inline void clr(u32 f){ bitmap[f >> 5] &= ~(1u << (f & 31)); }
+
+static void take(u32 f){
+    if(used(f)) return;
+    set(f);
+    stats.free_frames--;
+    u32 u = stats.total_frames - stats.free_frames;
+    if(u > stats.peak_used) stats.peak_used = u;
+}
+
+static void give(u32 f){
+    if(!used(f) || f >= nframes) return;
+    clr(f);
+    stats.free_frames++;
+    if(f/32 < next_hint) next_hint = f/32;
+}
+
+void pmm_reserve(u32 base, u32 size){
+    if(!size) return;
+    u64 end = ((u64)base + size + PAGE_SIZE - 1)/PAGE_SIZE;
+    if(end > nframes) end = nframes;
+    for(u32 f = base/PAGE_SIZE; f < end; f++) take(f);
+}
+
+void pmm_init(multiboot_info_t *m){
+    for(u32 i=0;i<MAX_FRAMES/32;i++) bitmap[i] = 0xFFFFFFFF;
+    nframes = 0;
+    stats.total_frames = stats.free_frames = stats.peak_used = 0;
+
+    multiboot_tag_t *tag;
+    for(tag=(multiboot_tag_t*)(m+1);tag->type!=0;tag=(multiboot_tag_t*)
+         ((u8*)tag+((tag->size+7)&~7)))
+    {
+        if(tag->type != MULTIBOOT_TAG_TYPE_MMAP) continue;
+        multiboot_tag_mmap_t *mm = (void*)tag;
+        for(u8 *e = (u8*)mm->entries; e + sizeof(multiboot_mmap_entry_t) <= (u8*)tag + tag->size;
+            e += mm->entry_size){
+            multiboot_mmap_entry_t *r = (void*)e;
+            if(r->type != MULTIBOOT_MEMORY_AVAILABLE) continue;
+            // whole frames only, below 4 GiB
+            u64 lo = (r->addr + PAGE_SIZE - 1)/PAGE_SIZE, hi = (r->addr + r->len)/PAGE_SIZE;
+            if(hi > MAX_FRAMES) hi = MAX_FRAMES;
+            for(u64 f = lo; f < hi; f++){
+                if(!used((u32)f)) continue;     // overlapping entries
+                clr((u32)f);
+                stats.total_frames++;
+                stats.free_frames++;
+            }
+            if(hi > nframes) nframes = (u32)hi;
+        }
+        break;
+    }
+
+    // real-mode area and BIOS data, the kernel, and what the loader left us
+    pmm_reserve(0, 0x100000);
+    pmm_reserve((u32)_kernel_start, (u32)(_kernel_end - _kernel_start));
+    pmm_reserve((u32)m, m->total_size);
+    for(tag=(multiboot_tag_t*)(m+1);tag->type!=0;tag=(multiboot_tag_t*)
+         ((u8*)tag+((tag->size+7)&~7)))
+    {
+        if(tag->type == MULTIBOOT_TAG_TYPE_MODULE){
+            multiboot_tag_module_t *mod = (void*)tag;
+            pmm_reserve(mod->mod_start, mod->mod_end - mod->mod_start);
+        }else if(tag->type == MULTIBOOT_TAG_TYPE_FRAMEBUFFER){
+            multiboot_tag_framebuffer_t *fb = (void*)tag;
+            if(fb->framebuffer_addr < 0x100000000ULL)
+                pmm_reserve((u32)fb->framebuffer_addr, fb->framebuffer_pitch*fb->framebuffer_height);
+        }
+    }
+    stats.peak_used = stats.total_frames - stats.free_frames;
+    next_hint = 0;
+}
+
+u32 pmm_alloc(void){
+    for(u32 w = next_hint; w < (nframes + 31)/32; w++){
+        if(bitmap[w] == 0xFFFFFFFF) continue;
+        u32 f = w*32 + __builtin_ctz(~bitmap[w]);
+        if(f >= nframes) break;
+        next_hint = w;
+        take(f);
+        return f*PAGE_SIZE;
+    }
+    return 0;
+}
+
+u32 pmm_alloc_contig(u32 frames, u32 align){
+    if(!frames) return 0;
+    if(frames == 1 && align <= PAGE_SIZE) return pmm_alloc();
+    u32 step = align > PAGE_SIZE ? align/PAGE_SIZE : 1;
+    for(u32 f = (next_hint*32 + step - 1)/step*step; f + frames <= nframes; f += step){
+        u32 n = 0;
+        while(n < frames && !used(f + n)) n++;
+        if(n == frames){
+            for(u32 i=0;i<frames;i++) take(f + i);
+            return f*PAGE_SIZE;
+        }
+        // no start before the used frame can work either
+        f = (f + n)/step*step;
+    }
+    return 0;
+}
+
+void pmm_free(u32 phys){ give(phys/PAGE_SIZE); }
+
+void pmm_free_contig(u32 phys, u32 frames){
+    for(u32 i=0;i<frames;i++) give(phys/PAGE_SIZE + i);
+}
+
+void pmm_stats(pmm_stats_t *st){ *st = stats; }
@@ -0,0 +1,29 @@
+#ifndef PMM_H
+#define PMM_H
+
+#include "common.h"
+#include "multiboot.h"
+
+#define PAGE_SIZE 4096u
+
+// Physical page frames below 4 GiB, from the multiboot memory map. Frames
+// start out used; AVAILABLE ranges are freed, then the first MiB, the
+// kernel image, the multiboot info, modules and the framebuffer are taken
+// back. Addresses are physical (= virtual under the identity map); 0 means
+// no memory.
+void pmm_init(multiboot_info_t *m);
+u32  pmm_alloc(void);
+u32  pmm_alloc_contig(u32 frames, u32 align);   // align: bytes, power of two
+void pmm_free(u32 phys);
+void pmm_free_contig(u32 phys, u32 frames);
+void pmm_reserve(u32 base, u32 size);           // mark a range used (any alignment)
+
+typedef struct {
+    u32 total_frames;   // usable RAM in the memory map
+    u32 free_frames;
+    u32 peak_used;      // high-water mark of total - free
+} pmm_stats_t;
+
+void pmm_stats(pmm_stats_t *st);
+
+#endif
@@ -0,0 +1,38 @@
+// psf.c — PSF2 bitmap fonts (Linux console format), from memory or a
+// multiboot module. Also built into tools/mkfont on the host.
+#include "psf.h"
+
+int psf_load(const void *data, u32 size, gfx_font_t *f)
+{
+    const psf2_header_t *h = data;
+    if(!data || size < sizeof(*h) || h->magic != PSF2_MAGIC) return -1;
+    if(h->width == 0 || h->width > 64 || h->height == 0 || h->height > 64 || h->length == 0) return -1;
+
+    u32 row = (h->width + 7)/8;
+    if(h->charsize < row*h->height) return -1;
+    if(h->headersize > size || (u64)h->length*h->charsize > size - h->headersize) return -1;
+
+    f->width = h->width;
+    f->height = h->height;
+    f->count = h->length > 256 ? 256 : h->length;   // text is 8-bit
+    f->bpp = 1;
+    f->row_bytes = row;
+    f->glyph_bytes = h->charsize;
+    f->data = (const u8*)data + h->headersize;
+    return 0;
+}
+
+int psf_from_multiboot(multiboot_info_t *m, gfx_font_t *f)
+{
+    multiboot_tag_t *tag;
+    for(tag=(multiboot_tag_t*)(m+1);tag->type!=0;tag=(multiboot_tag_t*)
+         ((u8*)tag+((tag->size+7)&~7)))
+    {
+        if(tag->type != MULTIBOOT_TAG_TYPE_MODULE) continue;
+        multiboot_tag_module_t *mod = (void*)tag;
+        if(mod->mod_end > mod->mod_start &&
+           psf_load((const void*)(unsigned long)mod->mod_start, mod->mod_end - mod->mod_start, f) == 0)
+            return 0;
+    }
+    return -1;
+}
@@ -0,0 +1,27 @@
+#ifndef PSF_H
+#define PSF_H
+
+#include "common.h"
+#include "graphics.h"
+#include "multiboot.h"
+
+#define PSF2_MAGIC 0x864AB572
+
+typedef struct {
+    u32 magic;
+    u32 version;
+    u32 headersize;     // offset of the glyph data
+    u32 flags;          // bit 0: unicode table follows the glyphs (ignored)
+    u32 length;         // number of glyphs
+    u32 charsize;       // bytes per glyph
+    u32 height, width;  // pixels
+} psf2_header_t;
+
+// Parse a PSF2 image into a mono gfx_font_t pointing into data (no copy).
+// Returns 0 on success, -1 if the image is not a usable PSF2 font.
+int psf_load(const void *data, u32 size, gfx_font_t *f);
+
+// Find the first multiboot module that is a PSF2 font and load it.
+int psf_from_multiboot(multiboot_info_t *m, gfx_font_t *f);
+
+#endif
@@ -10,6 +10,7 @@
 void *malloc(size_t size);
 void free(void *ptr);
 void *calloc(size_t nmemb, size_t size);
+void *realloc(void *ptr, size_t size);
 
 /* Abort/exit: no-op or infinite loop in freestanding environment */
 void abort(void);
@@ -1,28 +1,320 @@
 #include "string.h"
 #include "stddef.h"
 #include <stdarg.h>
-void *memset(void*s,int v,u32 n){u8*p=s;while(n--)*p++=v;return s;}
-void *memcpy(void*d,const void*s,u32 n){u8*D=d;const u8*S=s;while(n--)*D++=*S++;return d;}
-u32 strlen(const char* s){u32 L=0;while(s[L])L++;return L;}
-// NEW: strchr
-char *strchr(const char *s, int c) {
-    while (*s) {
-        if (*s == (char)c) return (char*)s;
-        s++;
+#include <stdint.h>
+#include "fpu.h"
+
+/* ------------------------------------------------------------
+memcpy/memset/memmove go through a table picked at boot with
+string_set_impl() (kernel.c, from CPUID):
+  byte  the original loops, kept for the benchmark
+  rep   rep movsd/stosd with byte heads and tails, the boot default
+  erms  rep movsb/stosb, for CPUs with enhanced rep strings
+        (CPUID.7:EBX.9), where the microcode beats hand-written loops
+  sse2  16-byte loads and aligned stores; from NT_MIN bytes on, streaming
+        (non-temporal) stores so a big copy does not flush the caches
+Overlapping memmoves use rep movsd (forwards, or backwards with std) in
+the rep and erms tables: rep movsb slows down to a crawl on close
+overlaps. The sse2 table uses its block loops, without streaming stores,
+which tools/string_bench.c shows four times faster.
+Below SMALL bytes every table uses a plain loop: setting up a rep string
+or a vector loop costs more than the copy itself.
+----------------------------------------------------------*/
+#define SMALL  32
+#define NT_MIN (1u << 20)
+
+typedef struct {
+    const char *name;
+    void *(*copy)(void *d, const void *s, u32 n);
+    void *(*set)(void *d, int c, u32 n);
+    void *(*move_fwd)(void *d, const void *s, u32 n);  // overlapping, d < s
+    void  (*move_back)(u8 *d, const u8 *s, u32 n);     // overlapping, d > s
+} string_ops_t;
+
+static void *copy_byte(void*d,const void*s,u32 n){u8*D=d;const u8*S=s;while(n--)*D++=*S++;return d;}
+static void *set_byte(void*s,int v,u32 n){u8*p=s;while(n--)*p++=v;return s;}
+static void move_back_byte(u8 *d, const u8 *s, u32 n){ while(n--) d[n] = s[n]; }
+
+static void *copy_rep(void *d, const void *s, u32 n){
+    void *r = d;
+    if(n < SMALL) return copy_byte(d, s, n);
+    uintptr_t head = -(uintptr_t)d & 3, words = (n - head) >> 2, tail = (n - head) & 3;
+    asm volatile("rep movsb" : "+D"(d), "+S"(s), "+c"(head) : : "memory");
+    asm volatile("rep movsl" : "+D"(d), "+S"(s), "+c"(words) : : "memory");
+    asm volatile("rep movsb" : "+D"(d), "+S"(s), "+c"(tail) : : "memory");
+    return r;
+}
+
+static void *set_rep(void *d, int c, u32 n){
+    void *r = d;
+    if(n < SMALL) return set_byte(d, c, n);
+    u32 v = (u8)c * 0x01010101u;
+    uintptr_t head = -(uintptr_t)d & 3, words = (n - head) >> 2, tail = (n - head) & 3;
+    asm volatile("rep stosb" : "+D"(d), "+c"(head) : "a"(v) : "memory");
+    asm volatile("rep stosl" : "+D"(d), "+c"(words) : "a"(v) : "memory");
+    asm volatile("rep stosb" : "+D"(d), "+c"(tail) : "a"(v) : "memory");
+    return r;
+}
+
+// the odd tail bytes first, then whole words with the direction flag set
+static void move_back_rep(u8 *d, const u8 *s, u32 n){
+    for(u32 t = n & 3; t; t--){ n--; d[n] = s[n]; }
+    uintptr_t words = n >> 2;
+    if(!words) return;
+    u8 *dw = d + n - 4;
+    const u8 *sw = s + n - 4;
+    asm volatile("std; rep movsl; cld" : "+D"(dw), "+S"(sw), "+c"(words) : : "memory");
+}
+
+static void *copy_erms(void *d, const void *s, u32 n){
+    void *r = d;
+    if(n < SMALL) return copy_byte(d, s, n);
+    uintptr_t k = n;
+    asm volatile("rep movsb" : "+D"(d), "+S"(s), "+c"(k) : : "memory");
+    return r;
+}
+
+static void *set_erms(void *d, int c, u32 n){
+    void *r = d;
+    if(n < SMALL) return set_byte(d, c, n);
+    uintptr_t k = n;
+    asm volatile("rep stosb" : "+D"(d), "+c"(k) : "a"(c) : "memory");
+    return r;
+}
+
+/* SSE2: a rep-string head aligns the destination, then 64 bytes per loop
+ * step. The loops are asm so they are tight whatever the optimisation
+ * level (the kernel is built without -O), and run between
+ * kernel_fpu_begin/end. Streaming stores are weakly ordered, hence the
+ * sfence after them. */
+#define SSE2 __attribute__((target("sse2")))
+
+#define LOAD4  "movdqu (%1), %%xmm0\n movdqu 16(%1), %%xmm1\n movdqu 32(%1), %%xmm2\n movdqu 48(%1), %%xmm3\n"
+#define STORE4(op) op " %%xmm0, (%0)\n " op " %%xmm1, 16(%0)\n " op " %%xmm2, 32(%0)\n " op " %%xmm3, 48(%0)\n"
+
+SSE2 static void *copy_fwd_sse2(void *d, const void *s, u32 n, int nt){
+    if(n < 128) return copy_rep(d, s, n);
+    u8 *D = d;
+    const u8 *S = s;
+    u32 head = -(uintptr_t)D & 15;
+    copy_rep(D, S, head);
+    D += head; S += head; n -= head;
+    uintptr_t blocks = n >> 6;
+    kernel_fpu_begin();
+    if(nt)
+        asm volatile("1:" LOAD4 STORE4("movntdq") "add $64, %0\n add $64, %1\n dec %2\n jnz 1b\n sfence"
+                     : "+r"(D), "+r"(S), "+r"(blocks) : : "memory", "xmm0", "xmm1", "xmm2", "xmm3");
+    else
+        asm volatile("1:" LOAD4 STORE4("movdqa") "add $64, %0\n add $64, %1\n dec %2\n jnz 1b"
+                     : "+r"(D), "+r"(S), "+r"(blocks) : : "memory", "xmm0", "xmm1", "xmm2", "xmm3");
+    kernel_fpu_end();
+    copy_rep(D, S, n & 63);
+    return d;
+}
+
+SSE2 static void *copy_sse2(void *d, const void *s, u32 n){ return copy_fwd_sse2(d, s, n, n >= NT_MIN); }
+SSE2 static void *move_fwd_sse2(void *d, const void *s, u32 n){ return copy_fwd_sse2(d, s, n, 0); }
+
+SSE2 static void *set_sse2(void *d, int c, u32 n){
+    if(n < 128) return set_rep(d, c, n);
+    u8 *D = d;
+    u32 head = -(uintptr_t)D & 15;
+    set_rep(D, c, head);
+    D += head; n -= head;
+    uintptr_t blocks = n >> 6;
+    u32 v = (u8)c * 0x01010101u;
+    kernel_fpu_begin();
+#define BCAST "movd %2, %%xmm0\n pshufd $0, %%xmm0, %%xmm0\n movdqa %%xmm0, %%xmm1\n movdqa %%xmm0, %%xmm2\n movdqa %%xmm0, %%xmm3\n"
+    if(n >= NT_MIN)
+        asm volatile(BCAST "1:" STORE4("movntdq") "add $64, %0\n dec %1\n jnz 1b\n sfence"
+                     : "+r"(D), "+r"(blocks) : "r"(v) : "memory", "xmm0", "xmm1", "xmm2", "xmm3");
+    else
+        asm volatile(BCAST "1:" STORE4("movdqa") "add $64, %0\n dec %1\n jnz 1b"
+                     : "+r"(D), "+r"(blocks) : "r"(v) : "memory", "xmm0", "xmm1", "xmm2", "xmm3");
+    kernel_fpu_end();
+    set_rep(D, c, n & 63);
+    return d;
+}
+
+// from the end, 16 bytes per step, each loaded before the store that may
+// overlap it; the first n % 16 bytes last
+SSE2 static void move_back_sse2(u8 *d, const u8 *s, u32 n){
+    uintptr_t blocks = n >> 4;
+    u8 *D = d + n;
+    const u8 *S = s + n;
+    if(blocks){
+        kernel_fpu_begin();
+        asm volatile("1: sub $16, %1\n sub $16, %0\n movdqu (%1), %%xmm0\n movdqu %%xmm0, (%0)\n dec %2\n jnz 1b"
+                     : "+r"(D), "+r"(S), "+r"(blocks) : : "memory", "xmm0");
+        kernel_fpu_end();
     }
-    return NULL;
+    move_back_byte(d, s, n & 15);
+}
+
+static const string_ops_t string_ops[] = {
+    [STRING_BYTE] = { "byte", copy_byte, set_byte, copy_byte,     move_back_byte },
+    [STRING_REP]  = { "rep",  copy_rep,  set_rep,  copy_rep,      move_back_rep },
+    [STRING_ERMS] = { "erms", copy_erms, set_erms, copy_rep,      move_back_rep },
+    [STRING_SSE2] = { "sse2", copy_sse2, set_sse2, move_fwd_sse2, move_back_sse2 },
+};
+static const string_ops_t *str_ops = &string_ops[STRING_REP];
+
+int string_set_impl(int impl){
+    if(impl < STRING_BYTE || impl > STRING_SSE2) return 0;
+    str_ops = &string_ops[impl];
+    return 1;
+}
+
+const char *string_impl_name(void){ return str_ops->name; }
+
+
+void *memset(void *s, int c, u32 n){ return str_ops->set(s, c, n); }
+void *memcpy(void *d, const void *s, u32 n){ return str_ops->copy(d, s, n); }
+
+void *memmove(void *dest, const void *src, size_t n){
+    u8 *d = dest;
+    const u8 *s = src;
+    if (d == s || n == 0) return dest;
+    if (d + n <= s || s + n <= d) return str_ops->copy(d, s, n);
+    if (d < s) return str_ops->move_fwd(d, s, n);
+    str_ops->move_back(d, s, n);
+    return dest;
 }
+/* ------------------------------------------------------------
+Scanning: strlen, memchr, strchr, memmem/strstr. The byte loops look at a
+word (4 bytes) per step: a byte of w is zero exactly where
+zero_bytes(w) has its high bit, counting from the low end up to the
+first such byte (higher ones may be false hits), so the lowest set bit
+finds the first match and XOR with a repeated byte finds that byte.
+Aligned words and 32-byte blocks never cross a page, so NUL-terminated
+scans may read a little past the terminator but never fault. With string_set_simd(1),
+scans longer than SIMD_SCAN go on 32 bytes per step with SSE2.
+----------------------------------------------------------*/
+#define SIMD_SCAN 64
+#define ONES  0x01010101u
+#define HIGHS 0x80808080u
 
-// NEW: strstr
-char *strstr(const char *haystack, const char *needle) {
-    if (!*needle) return (char*)haystack;
-    for (; *haystack; haystack++) {
-        const char *h = haystack;
-        const char *n = needle;
-        while (*h && *n && *h == *n) { h++; n++; }
-        if (!*n) return (char*)haystack;
+typedef u32 __attribute__((may_alias)) word_t;
+typedef u32 __attribute__((may_alias, aligned(1))) uword_t;
+
+static int scan_simd = 0;
+
+int string_set_simd(int enable){
+    scan_simd = enable != 0;
+    return scan_simd;
+}
+
+static inline u32 zero_bytes(u32 w){ return (w - ONES) & ~w & HIGHS; }
+
+// first byte equal to a or b in p[0..n), or NULL; NUL-terminated scans
+// pass n = (size_t)-1
+static const u8 *find2_words(const u8 *p, size_t n, u8 a, u8 b){
+    for(; n && ((uintptr_t)p & 3); p++, n--) if(*p == a || *p == b) return p;
+    u32 aa = a*ONES, bb = b*ONES;
+    for(; n >= 4; p += 4, n -= 4){
+        u32 w = *(const word_t*)p, m = zero_bytes(w ^ aa) | zero_bytes(w ^ bb);
+        if(m) return p + (__builtin_ctz(m) >> 3);
+    }
+    for(; n; p++, n--) if(*p == a || *p == b) return p;
+    return 0;
+}
+
+// 32-byte blocks from a 32-byte aligned p, so a block never straddles a
+// page: the first block holding a or b, or NULL after the given number
+SSE2 static const u8 *find2_sse2(const u8 *p, uintptr_t blocks, u8 a, u8 b){
+    u32 aa = a*ONES, bb = b*ONES, m;
+    kernel_fpu_begin();
+    asm volatile("movd %3, %%xmm2\n pshufd $0, %%xmm2, %%xmm2\n movd %4, %%xmm3\n pshufd $0, %%xmm3, %%xmm3\n"
+                 "1: movdqa (%0), %%xmm0\n movdqa 16(%0), %%xmm1\n movdqa %%xmm0, %%xmm4\n movdqa %%xmm1, %%xmm5\n"
+                 "pcmpeqb %%xmm2, %%xmm0\n pcmpeqb %%xmm2, %%xmm1\n pcmpeqb %%xmm3, %%xmm4\n pcmpeqb %%xmm3, %%xmm5\n"
+                 "por %%xmm1, %%xmm0\n por %%xmm5, %%xmm4\n por %%xmm4, %%xmm0\n pmovmskb %%xmm0, %2\n"
+                 "test %2, %2\n jnz 2f\n add $32, %0\n dec %1\n jnz 1b\n 2:"
+                 : "+r"(p), "+r"(blocks), "=&r"(m) : "m"(aa), "m"(bb)
+                 : "memory", "cc", "xmm0", "xmm1", "xmm2", "xmm3", "xmm4", "xmm5");
+    kernel_fpu_end();
+    return m ? p : 0;
+}
+
+static const u8 *find2(const u8 *p, size_t n, u8 a, u8 b){
+    if(!scan_simd || n < SIMD_SCAN) return find2_words(p, n, a, b);
+    // most strings end in the head, which also aligns p to 32 for the SSE2 loop
+    size_t head = SIMD_SCAN - ((uintptr_t)p & 31);
+    const u8 *r = find2_words(p, head, a, b);
+    if(r) return r;
+    p += head; n -= head;
+    if(n >= 32){
+        if((r = find2_sse2(p, n >> 5, a, b)) != 0) return find2_words(r, 32, a, b);
+        p += n & ~(size_t)31;
+    }
+    return find2_words(p, n & 31, a, b);
+}
+
+u32 strlen(const char *s){ return (u32)((const char*)find2((const u8*)s, (size_t)-1, 0, 0) - s); }
+
+void *memchr(const void *s, int c, size_t n){ return (void*)find2(s, n, (u8)c, (u8)c); }
+
+char *strchr(const char *s, int c){
+    const char *p = (const char*)find2((const u8*)s, (size_t)-1, 0, (u8)c);
+    return *p == (char)c ? (char*)p : NULL;
+}
+
+static int same(const u8 *a, const u8 *b, size_t n){
+    while(n--) if(*a++ != *b++) return 0;
+    return 1;
+}
+
+/* memmem: candidates are the positions where both the first and the last
+ * byte of the needle match, 16 (SSE2) or 4 positions (words) at a time;
+ * only those are compared in full. Linear unless the haystack is full of
+ * near-matches, which protocol text is not. */
+SSE2 static size_t memmem_sse2(const u8 *h, size_t end, const u8 *n, size_t nl, const u8 **found){
+    u32 ff = n[0]*ONES, ll = n[nl-1]*ONES, m;
+    const u8 *p = h;
+    uintptr_t blocks = end >> 4;
+    *found = 0;
+    kernel_fpu_begin();
+    while(blocks){
+        // on to the next 16 positions with a candidate
+        asm volatile("movd %4, %%xmm2\n pshufd $0, %%xmm2, %%xmm2\n movd %5, %%xmm3\n pshufd $0, %%xmm3, %%xmm3\n"
+                     "1: movdqu (%0), %%xmm0\n movdqu -1(%0,%3), %%xmm1\n pcmpeqb %%xmm2, %%xmm0\n pcmpeqb %%xmm3, %%xmm1\n"
+                     "pand %%xmm1, %%xmm0\n pmovmskb %%xmm0, %2\n test %2, %2\n jnz 2f\n"
+                     "add $16, %0\n dec %1\n jnz 1b\n 2:"
+                     : "+r"(p), "+r"(blocks), "=&r"(m) : "r"(nl), "m"(ff), "m"(ll)
+                     : "memory", "cc", "xmm0", "xmm1", "xmm2", "xmm3");
+        for(; m; m &= m - 1){
+            const u8 *c = p + __builtin_ctz(m);
+            if(same(c + 1, n + 1, nl - 2)){ *found = c; blocks = 0; break; }
+        }
+        if(blocks){ p += 16; blocks--; }
+    }
+    kernel_fpu_end();
+    return (size_t)(p - h);
+}
+
+void *memmem(const void *hay, size_t hl, const void *needle, size_t nl){
+    const u8 *h = hay, *n = needle, *c;
+    if(!nl) return (void*)h;
+    if(nl > hl) return 0;
+    if(nl == 1) return memchr(h, n[0], hl);
+    size_t end = hl - nl + 1, i = 0;      // candidate positions: [0, end)
+    if(scan_simd && end >= SIMD_SCAN){
+        i = memmem_sse2(h, end, n, nl, &c);
+        if(c) return (void*)c;
+    }
+    u32 ff = n[0]*ONES, ll = n[nl-1]*ONES;
+    for(; i + 4 <= end; i += 4){
+        u32 m = zero_bytes(*(const uword_t*)(h + i) ^ ff) & zero_bytes(*(const uword_t*)(h + i + nl - 1) ^ ll);
+        for(; m; m &= m - 1){
+            c = h + i + (__builtin_ctz(m) >> 3);
+            if(same(c, n, nl)) return (void*)c;   // m may hold false hits
+        }
     }
-    return NULL;
+    for(; i < end; i++) if(same(h + i, n, nl)) return (void*)(h + i);
+    return 0;
+}
+
+char *strstr(const char *haystack, const char *needle){
+    return memmem(haystack, strlen(haystack), needle, strlen(needle));
 }
 
 // NEW: atoi
@@ -34,17 +326,6 @@ int atoi(const char *s) {
     }
     return n;
 }
-void *memmove(void *dest, const void *src, size_t n){
-    unsigned char *d = (unsigned char*)dest;
-    const unsigned char *s = (const unsigned char*)src;
-    if (d == s || n == 0) return dest;
-    if (d < s){
-        for (size_t i=0;i<n;i++) d[i] = s[i];
-    }else{
-        for (size_t i=n; i>0; i--) d[i-1] = s[i-1];
-    }
-    return dest;
-}
 
 // ensure our snprintf symbol is available for mbedTLS build
 int snprintf(char *buf, size_t size, const char *fmt, ...){
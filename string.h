@@ -15,6 +15,18 @@ int atoi(const char *s);
 void *memmove(void *dst, const void *src, size_t n);
 int   snprintf(char *buf, size_t size, const char *fmt, ...);
 
+// memcpy/memset/memmove implementations (string.c); rep strings until the
+// kernel picks one at boot. The caller checks CPU/OS support.
+enum { STRING_BYTE, STRING_REP, STRING_ERMS, STRING_SSE2 };
+int  string_set_impl(int impl);     // 0 for an unknown impl
+const char *string_impl_name(void);
+int  string_set_simd(int enable);   // SSE2 scans in strlen/memchr/strchr/memmem
+
+void *memchr(const void *s, int c, size_t n);
+// first occurrence of needle[0..nl) in hay[0..hl), or NULL; strstr() is
+// memmem() over strlen() of both
+void *memmem(const void *hay, size_t hl, const void *needle, size_t nl);
+
 // Added helpers
 int strcmp(const char *a, const char *b);
 int strncmp(const char *a, const char *b, size_t n);
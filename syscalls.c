@@ -21,6 +21,7 @@ void console_puts(const char *s){
         // simple wrap: reset to top
         cons_y = 6;
     }
+    gfx_flush();
 }
 
 // IDT structures for 32-bit protected mode
@@ -81,16 +82,18 @@ void syscall_handler_c(uint32_t *regs){
     }
 }
 
-void init_syscalls(void){
-    // Zero IDT
-    for (int i = 0; i < 256; ++i){
-        set_idt_entry(i, 0, 0, 0);
+// Point vector vec at an interrupt gate for stub (kernel code segment,
+// DPL 0). The IDT is loaded on first use; other vectors stay not present.
+void idt_set_gate(int vec, void (*stub)(void)){
+    set_idt_entry(vec, (uint32_t)stub, 0x08, 0x8E);
+    if (!idtp.base){
+        idtp.limit = sizeof(idt) - 1;
+        idtp.base = (uint32_t)&idt;
+        asm volatile ("lidt (%0)" :: "r"(&idtp));
     }
-    // set int 0x80
-    set_idt_entry(0x80, (uint32_t)irq80_stub, 0x08, 0x8E);
+}
 
-    idtp.limit = sizeof(idt) - 1;
-    idtp.base = (uint32_t)&idt;
-    // load IDT
-    asm volatile ("lidt (%0)" :: "r"(&idtp));
+void init_syscalls(void){
+    // set int 0x80
+    idt_set_gate(0x80, irq80_stub);
 }
\ No newline at end of file
@@ -7,6 +7,7 @@ extern volatile int user_exited;
 extern volatile int user_exit_code;
 
 void init_syscalls(void);
+void idt_set_gate(int vec, void (*stub)(void));
 
 // syscall numbers
 #define SYSCALL_WRITE 1
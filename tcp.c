@@ -4,6 +4,7 @@
 #include <stdint.h>
 #include <stddef.h>
 #include "endian.h"
+#include "csum.h"
 #include "stdio.h"
 
 
@@ -21,63 +22,28 @@ typedef struct {
 
 tcp_socket_t g_sock; // single socket
 
-// ===== utils =====
-static uint16_t csum16(const void* data, int len) {
-    const uint16_t *w = (const uint16_t*)data;
-    uint32_t sum=0;
-    while (len > 1) { sum += *w++; len -= 2; }
-    if (len) sum += *(const uint8_t*)w;
-    while (sum>>16) sum = (sum&0xFFFF) + (sum>>16);
-    return (uint16_t)(~sum);
-}
-
-#pragma pack(push,1)
-typedef struct {
-    uint32_t src;
-    uint32_t dst;
-    uint8_t  zero;
-    uint8_t  proto;
-    uint16_t tcp_len;
-} pseudo_t;
-#pragma pack(pop)
-
 static void tcp_send_segment(tcp_socket_t *s, uint8_t flags, const void *payload, int plen) {
-    uint8_t buf[60 + 1460]; // hdr + payload
-    uint8_t *p = buf;
-
-    // ---- IP header (filled by net_send_ip later) ----
-    // We let net_send_ip build IP; here we only pass TCP payload.
-
     // ---- TCP header ----
-    tcp_hdr_t *th = (tcp_hdr_t*)p;
-    th->src = htons(s->local_port);
-    th->dst = htons(s->remote_port);
-    th->seq = htonl(s->snd_nxt);
-    th->ack = htonl(s->rcv_nxt);
-    th->off_res = (5<<4);
-    th->flags = flags;
-    th->win   = htons(4096);
-    th->urgp  = 0;
-    th->chksum= 0;
-
-    p += sizeof(*th);
-    if (plen>0) { memcpy(p, payload, plen); p += plen; }
-
-    // checksum over pseudo + TCP hdr + data
-    pseudo_t ph;
-    ph.src = htonl(s->local_ip);
-    ph.dst = htonl(s->remote_ip);
-    ph.zero = 0;
-    ph.proto = 6;
-    ph.tcp_len = htons((uint16_t)(sizeof(*th)+plen));
-
-    uint8_t csumblk[sizeof(ph) + sizeof(*th) + 1460];
-    memcpy(csumblk, &ph, sizeof(ph));
-    memcpy(csumblk+sizeof(ph), th, sizeof(*th)+plen);
-    th->chksum = csum16(csumblk, (int)(sizeof(ph)+sizeof(*th)+plen));
+    // IP header and frame are built by net_send_l4, which also copies the
+    // payload into the frame and finishes the checksum in the same pass.
+    tcp_hdr_t th;
+    th.src = htons(s->local_port);
+    th.dst = htons(s->remote_port);
+    th.seq = htonl(s->snd_nxt);
+    th.ack = htonl(s->rcv_nxt);
+    th.off_res = (5<<4);
+    th.flags = flags;
+    th.win   = htons(4096);
+    th.urgp  = 0;
+    th.chksum= 0;
+
+    // checksum over pseudo + TCP hdr here, data in net_send_l4
+    uint32_t sum = csum_pseudo(s->local_ip, s->remote_ip, 6, (uint16_t)(sizeof(th)+plen), 0);
+    sum = csum_partial(&th, sizeof(th), sum);
 
     // send as IP proto 6
-    net_send_ip(s->remote_ip, 6 /*TCP*/, (uint8_t*)th, (int)(sizeof(*th)+plen));
+    net_send_l4(s->remote_ip, 6 /*TCP*/, &th, sizeof(th), offsetof(tcp_hdr_t, chksum),
+                sum, payload, plen);
 }
 
 static uint16_t pick_ephemeral(void) { static uint16_t p=40000; return p++; }
@@ -182,6 +148,7 @@ void tcp_on_rx(const uint8_t *ip_pkt, int ip_len, uint32_t src_ip, uint32_t dst_
 int tcp_send(tcp_socket_t *s, const void *data, int len) {
     if (s->state != TCP_ESTABLISHED) return -1;
     if (len <= 0) return 0;
+    if (len > 1460) len = 1460;   // one MSS per segment; callers resend the rest
     tcp_send_segment(s, 0x18 /*PSH+ACK*/, data, len);
     s->snd_nxt += (uint32_t)len;
     return len;
@@ -7,6 +7,7 @@
 #include "string.h"
 #include "io.h" // for debug prints if needed
 #include "rtl8139.h"
+#include "ktime.h"
 
 #include "mbedtls/ssl.h"
 #include "mbedtls/ctr_drbg.h"
@@ -15,6 +16,9 @@
 
 #include <stdio.h>
 
+#define TLS_HANDSHAKE_MS 5000  // ClientHello to Finished
+#define TLS_IDLE_MS      5000  // no record and no close_notify: take what arrived
+
 /* Provide ssize_t for freestanding build */
 typedef int ssize_t;
 #include "vendor/mbedtls/include/mbedtls/net_sockets.h"
@@ -22,7 +26,7 @@ typedef int ssize_t;
 // Expose mbedTLS debug buffer accessor from platform_shim
 extern const char *mbedtls_get_debug(void);
 
-// No custom calloc/free here — use the kernel's malloc/free implementations (kmalloc_stub.c)
+// No custom calloc/free here — use the kernel's malloc/free implementations (heap.c)
 
 // Provide a simple time stub used by some parts of mbedTLS when macros expect it
 long mbedtls_time_stub(long *t){ if(t) *t = 0; return 0; }
@@ -108,17 +112,14 @@ int tls_http_get_by_ip(uint32_t ip, const char *host_header, const char *path, c
 
     // perform handshake (simple loop with NIC polling)
     int ret;
+    deadline_t handshake_by = ktime_deadline_ms(TLS_HANDSHAKE_MS);
     while((ret = mbedtls_ssl_handshake(&ssl)) != 0){
-        if(ret == MBEDTLS_ERR_SSL_WANT_READ || ret == MBEDTLS_ERR_SSL_WANT_WRITE){
+        if((ret == MBEDTLS_ERR_SSL_WANT_READ || ret == MBEDTLS_ERR_SSL_WANT_WRITE) && !ktime_expired(handshake_by)){
             // pump NIC to advance TCP state
             if (rtl8139_is_ready()) rtl8139_poll();
             continue;
         }
-        // failure
-        mbedtls_ssl_free(&ssl);
-        mbedtls_ssl_config_free(&conf);
-        free(s);
-        return -1;
+        goto cleanup_err; // failure, or the server never finished
     }
 
     // Build GET request
@@ -132,10 +133,11 @@ int tls_http_get_by_ip(uint32_t ip, const char *host_header, const char *path, c
 
     // read response into out buffer
     int total = 0;
+    deadline_t idle_by = ktime_deadline_ms(TLS_IDLE_MS);
     while(total < out_cap - 1){
         int r = mbedtls_ssl_read(&ssl, (unsigned char*)(out + total), out_cap - 1 - total);
-        if(r > 0){ total += r; continue; }
-        if(r == MBEDTLS_ERR_SSL_WANT_READ || r == MBEDTLS_ERR_SSL_WANT_WRITE){
+        if(r > 0){ total += r; idle_by = ktime_deadline_ms(TLS_IDLE_MS); continue; }
+        if((r == MBEDTLS_ERR_SSL_WANT_READ || r == MBEDTLS_ERR_SSL_WANT_WRITE) && !ktime_expired(idle_by)){
             if (rtl8139_is_ready()) rtl8139_poll();
             continue;
         }
@@ -0,0 +1,140 @@
+// gfx_bench.c — hosted micro-benchmarks for the graphics.c primitives.
+//
+// Builds graphics.c + font.c (and the generated font_ui.c) for Linux against a RAM framebuffer at the
+// same 1450x1000x32 mode boot.asm requests, and prints ns/call and
+// Mpixels/s per primitive. Iteration counts and the PRNG seed are fixed so
+// runs are comparable; build with `make bench-gfx`.
+#define _POSIX_C_SOURCE 199309L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "graphics.h"
+#include "font.h"
+
+#define FB_W 1450
+#define FB_H 1000
+
+// graphics.c keeps the framebuffer address in a u32, so the fake VRAM must
+// live in the low 4 GiB: a static array in a non-PIE binary does.
+static u32 fake_vram[FB_W*FB_H*2];
+
+void *kmalloc(size_t sz){ return malloc(sz); }
+void kernel_fpu_begin(void){}   // Linux keeps the SSE state for us
+void kernel_fpu_end(void){}
+
+static unsigned rng = 12345;
+static int rnd(int n){ rng = rng*1103515245u + 12345u; return (int)((rng >> 8) % (unsigned)n); }
+
+static double now_ns(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec*1e9 + ts.tv_nsec;
+}
+
+static void report(const char *name, int calls, double ns, double pixels_per_call){
+    double per = ns/calls;
+    printf("%-28s %9d calls %12.1f ns/call %10.1f Mpix/s\n",
+           name, calls, per, pixels_per_call > 0 ? pixels_per_call*1e3/per : 0.0);
+}
+
+// the body is variadic so it may contain commas
+#define BENCH(name, calls, pix, ...) do { \
+    for(int i_=0;i_<(calls)/10+1;i_++){ __VA_ARGS__; } \
+    gfx_flush(); \
+    double t0_ = now_ns(); \
+    for(int i_=0;i_<(calls);i_++){ __VA_ARGS__; } \
+    double t1_ = now_ns(); \
+    report(name, calls, t1_-t0_, pix); \
+    gfx_flush(); \
+} while(0)
+
+int main(void){
+    struct {
+        multiboot_info_t info;
+        multiboot_tag_framebuffer_t fb;
+        multiboot_tag_t end;
+    } __attribute__((packed, aligned(8))) mb;
+    memset(&mb, 0, sizeof(mb));
+    mb.info.total_size = sizeof(mb);
+    mb.fb.type = MULTIBOOT_TAG_TYPE_FRAMEBUFFER;
+    mb.fb.size = sizeof(mb.fb);
+    mb.fb.framebuffer_addr = (u32)(unsigned long)fake_vram;
+    mb.fb.framebuffer_pitch = FB_W*4;
+    mb.fb.framebuffer_width = FB_W;
+    mb.fb.framebuffer_height = FB_H;
+    mb.fb.framebuffer_bpp = 32;
+    mb.fb.framebuffer_type = 1;
+    mb.fb.red_field_position = 16;   mb.fb.red_mask_size = 8;
+    mb.fb.green_field_position = 8;  mb.fb.green_mask_size = 8;
+    mb.fb.blue_field_position = 0;   mb.fb.blue_mask_size = 8;
+    init_graphics(&mb.info);
+    if(!framebuffer_addr){ fprintf(stderr, "init_graphics failed\n"); return 1; }
+
+    printf("gfx_bench: %dx%dx32, back buffer + damage flush\n", FB_W, FB_H);
+
+    const char *line = "The quick brown fox jumps over the lazy dog 0123456789 {}[]:,\"";
+    int line_len = (int)strlen(line);
+
+    BENCH("clear (draw_rect full)", 200, (double)FB_W*FB_H,
+          draw_rect(0, 0, FB_W, FB_H, 0x87CEEB));
+    BENCH("clear + flush", 200, (double)FB_W*FB_H,
+          { draw_rect(0, 0, FB_W, FB_H, 0x87CEEB); gfx_flush(); });
+    BENCH("draw_rect 100x100", 20000, 100.0*100,
+          draw_rect(rnd(FB_W-100), rnd(FB_H-100), 100, 100, (u32)rng));
+    BENCH("draw_rect 8x8", 200000, 64.0,
+          draw_rect(rnd(FB_W-8), rnd(FB_H-8), 8, 8, (u32)rng));
+    BENCH("draw_string 62 chars", 50000, 62.0*64,
+          draw_string(rnd(FB_W-8*line_len), rnd(FB_H-8), line, 0x000000));
+    BENCH("draw_text AA 12px 62 chars", 50000, 62.0*12*12,
+          gfx_draw_text(&font_ui_aa, rnd(FB_W-12*line_len), rnd(FB_H-12), line, 0x000000));
+    BENCH("draw_rounded 300x200 r15", 5000, 300.0*200,
+          draw_rounded(rnd(FB_W-300), rnd(FB_H-200), 300, 200, 15, 0xCCCCCC));
+    BENCH("fill_circle r32", 20000, 3.14159*32*32,
+          fill_circle(40+rnd(FB_W-80), 40+rnd(FB_H-80), 32, 0x8888FF));
+    BENCH("draw_line 200px any angle", 50000, 200.0,
+          { int a = rnd(FB_W-200), b = rnd(FB_H-200), d = rnd(200);
+            draw_line(a, b + d, a + 199, b + 199 - d, 0x00AA00); });
+    BENCH("draw_line 200px horizontal", 50000, 200.0,
+          { int a = rnd(FB_W-200), b = rnd(FB_H); draw_line(a, b, a + 199, b, 0x00AA00); });
+    {
+        static gfx_point_t graph[256];
+        for(int i=0;i<256;i++){ graph[i].x = 100 + i*4; graph[i].y = 500 + rnd(200) - 100; }
+        BENCH("gfx_polyline 255 segments", 5000, 0.0,
+              gfx_polyline(graph, 256, 0xFF8800));
+    }
+    {
+        // blending blits, scalar vs SSE2 kernels (same results, see gfx_blend.c)
+        static u32 sprite_px[256*256];
+        gfx_surface_t sprite = { sprite_px, 256, 256, 0 };
+        for(int i=0;i<256*256;i++){
+            u32 a = (u32)(i & 0xFF);   // premultiplied: channels <= alpha
+            sprite_px[i] = a << 24 | (a*3/4) << 16 | (a/2) << 8 | (a/4);
+        }
+        for(int simd=0;simd<2;simd++){
+            char name[64];
+            gfx_set_simd(simd);
+            snprintf(name, sizeof(name), "blit alpha 256x256 %s", gfx_simd_name());
+            BENCH(name, 2000, 256.0*256,
+                  gfx_blit_surface(rnd(FB_W-256), rnd(FB_H-256), &sprite, 0, 0, 256, 256, GFX_BLIT_ALPHA, 0));
+            snprintf(name, sizeof(name), "blit blend 256x256 %s", gfx_simd_name());
+            BENCH(name, 2000, 256.0*256,
+                  gfx_blit_surface(rnd(FB_W-256), rnd(FB_H-256), &sprite, 0, 0, 256, 256, GFX_BLIT_BLEND, 128));
+            snprintf(name, sizeof(name), "blit key 256x256 %s", gfx_simd_name());
+            BENCH(name, 2000, 256.0*256,
+                  gfx_blit_surface(rnd(FB_W-256), rnd(FB_H-256), &sprite, 0, 0, 256, 256, GFX_BLIT_KEY, 0));
+            snprintf(name, sizeof(name), "fill_blend 300x200 %s", gfx_simd_name());
+            BENCH(name, 2000, 300.0*200,
+                  gfx_fill_blend(rnd(FB_W-300), rnd(FB_H-200), 300, 200, 0x80000000));
+        }
+        gfx_set_simd(0);
+    }
+    BENCH("put_pixel", 1000000, 1.0,
+          put_pixel(rnd(FB_W), rnd(FB_H), 0xFF0000));
+    BENCH("cursor move + flush", 200000, 2*8.0*8,
+          { gfx_cursor_move(rnd(FB_W-8), rnd(FB_H-8)); gfx_flush(); });
+    BENCH("flush (idle)", 1000000, 0.0,
+          gfx_flush());
+
+    return 0;
+}
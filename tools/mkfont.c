@@ -0,0 +1,90 @@
+// mkfont.c — build-time glyph atlas generator.
+//
+//   mkfont NAME HEIGHT [font.psf] > NAME.c
+//
+// Reads a PSF2 font (or the built-in 8x8 font from font.c when no file is
+// given) and writes C source for two gfx_font_t atlases:
+//   NAME     the glyphs as they are, 1 bpp
+//   NAME_aa  the glyphs scaled to HEIGHT pixels (width in proportion),
+//            4 bpp coverage from 4x4 supersampling of the source bitmap
+// so the kernel never scales or filters glyphs at run time; drawing the AA
+// atlas is a table lookup per pixel (gfx_draw_text in graphics.c).
+#include <stdio.h>
+#include <stdlib.h>
+#include "font.h"
+#include "psf.h"
+
+#define SS 4   // supersamples per axis
+
+static int src_bit(const gfx_font_t *f, int ch, int x, int y)
+{
+    const u8 *g = f->data + ch*f->glyph_bytes + y*f->row_bytes;
+    return (g[x >> 3] >> (7 - (x & 7))) & 1;
+}
+
+static void emit_bytes(const char *name, const u8 *p, long n)
+{
+    printf("static const u8 %s_data[%ld] = {", name, n);
+    for(long i=0;i<n;i++) printf("%s0x%02x,", i % 16 ? "" : "\n    ", p[i]);
+    printf("\n};\n");
+}
+
+int main(int argc, char **argv)
+{
+    if(argc < 3 || argc > 4){
+        fprintf(stderr, "usage: %s NAME HEIGHT [font.psf] > NAME.c\n", argv[0]);
+        return 2;
+    }
+    const char *name = argv[1];
+    int oh = atoi(argv[2]);
+    gfx_font_t src = { 8, 8, 256, 1, 1, 8, &font[0][0] };
+
+    if(argc == 4){
+        FILE *fp = fopen(argv[3], "rb");
+        if(!fp){ perror(argv[3]); return 1; }
+        static u8 buf[1 << 20];
+        size_t n = fread(buf, 1, sizeof(buf), fp);
+        fclose(fp);
+        if(psf_load(buf, (u32)n, &src) != 0){
+            fprintf(stderr, "%s: not a PSF2 font\n", argv[3]);
+            return 1;
+        }
+    }
+    if(oh < 1 || oh > 64){ fprintf(stderr, "HEIGHT must be 1..64\n"); return 2; }
+
+    int ow = (src.width*oh + src.height/2)/src.height;
+    if(ow < 1) ow = 1;
+    int orow = (ow + 1)/2, oglyph = orow*oh;
+    u8 *aa = calloc((size_t)src.count, oglyph);
+
+    for(int ch=0;ch<src.count;ch++)
+        for(int y=0;y<oh;y++)
+            for(int x=0;x<ow;x++){
+                // sample centres of an SS x SS grid over the output pixel,
+                // mapped back to source pixels
+                int n = 0;
+                for(int sy=0;sy<SS;sy++)
+                    for(int sx=0;sx<SS;sx++){
+                        int px = ((x*SS + sx)*2 + 1)*src.width  / (2*SS*ow);
+                        int py = ((y*SS + sy)*2 + 1)*src.height / (2*SS*oh);
+                        n += src_bit(&src, ch, px, py);
+                    }
+                int k = (n*15 + SS*SS/2)/(SS*SS);
+                u8 *b = aa + ch*oglyph + y*orow + x/2;
+                *b |= (x & 1) ? k : k << 4;
+            }
+
+    printf("// generated by tools/mkfont from %s, do not edit\n", argc == 4 ? argv[3] : "font.c");
+    printf("#include \"font.h\"\n\n");
+
+    char aname[128];
+    snprintf(aname, sizeof(aname), "%s_aa", name);
+    emit_bytes(name, src.data, (long)src.count*src.glyph_bytes);
+    printf("const gfx_font_t %s = { %d, %d, %d, 1, %d, %d, %s_data };\n\n",
+           name, src.width, src.height, src.count, src.row_bytes, src.glyph_bytes, name);
+    emit_bytes(aname, aa, (long)src.count*oglyph);
+    printf("const gfx_font_t %s = { %d, %d, %d, 4, %d, %d, %s_data };\n",
+           aname, ow, oh, src.count, orow, oglyph, aname);
+    free(aa);
+    return 0;
+}
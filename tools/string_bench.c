@@ -0,0 +1,283 @@
+// string_bench.c — hosted size sweep of the string.c primitives.
+//
+// Builds string.c for Linux (with the flags build.sh gives it) and
+// times every memcpy/memset/memmove implementation string_set_impl() knows,
+// "byte" being the original loops, over sizes from 8 bytes to 8 MiB; then
+// the scans (strlen, memchr, memmem, strstr) as the original byte loops
+// (copied here), word at a time and with SSE2. Prints GB/s per size and
+// implementation; buffers are reused, so sizes up to the cache sizes
+// measure cache-hot work. Every implementation is first compared with the
+// byte loops, and the scans run up to an unmapped page. Build with
+// `make bench-string`. SSE2 is used without the CR4 check the kernel
+// does: Linux has SSE enabled.
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <sys/mman.h>
+#include "string.h"
+
+#define NIMPL 4
+#define MAXSZ (8u << 20)
+#define NT    (1u << 20)            // string.c's NT_MIN: sse2 streams from here on
+
+void kernel_fpu_begin(void){}   // Linux keeps the SSE state for us
+void kernel_fpu_end(void){}
+
+static double now_ns(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec*1e9 + ts.tv_nsec;
+}
+
+static unsigned char *src, *dst;
+
+enum { OP_COPY, OP_COPY_UNALIGNED, OP_SET, OP_MOVE_UP, OP_MOVE_DOWN, NOPS };
+static const char *const op_name[] = {
+    "memcpy (aligned)", "memcpy (src+1, dst+3)", "memset",
+    "memmove (overlap, dst = src+8)", "memmove (overlap, dst = src-8)"
+};
+
+static double run(int op, u32 n){
+    // about 64 MiB moved per measurement, at least 4 calls
+    long calls = (64l << 20)/n;
+    if(calls < 4) calls = 4;
+    double t0 = now_ns();
+    for(long i=0;i<calls;i++){
+        switch(op){
+        case OP_COPY:           memcpy(dst, src, n); break;
+        case OP_COPY_UNALIGNED: memcpy(dst + 3, src + 1, n); break;
+        case OP_SET:            memset(dst, (int)i, n); break;
+        case OP_MOVE_UP:        memmove(dst + 8, dst, n); break;
+        case OP_MOVE_DOWN:      memmove(dst, dst + 8, n); break;
+        }
+    }
+    double t1 = now_ns();
+    return (double)calls*n/(t1 - t0);   // bytes per ns = GB/s
+}
+
+// results must match the byte loops before anything is timed
+static int check(void){
+    static unsigned char ref[4096 + 64], out[4096 + 64];
+    int bad = 0;
+    for(int impl=STRING_REP;impl<NIMPL;impl++)
+        for(u32 n=0;n<4096;n = n < 80 ? n + 1 : n*3/2)
+            for(int off=0;off<4;off++){
+                for(u32 i=0;i<sizeof(ref);i++) ref[i] = out[i] = (unsigned char)(i*7);
+                string_set_impl(STRING_BYTE);
+                memmove(ref + 8 + off, ref + off, n);
+                memmove(ref + off, ref + 5, n);
+                memcpy(ref + 2048 + 64, ref + 3 - off + 8, n/2);
+                memset(ref + off, off*40, n/3);
+                string_set_impl(impl);
+                memmove(out + 8 + off, out + off, n);
+                memmove(out + off, out + 5, n);
+                memcpy(out + 2048 + 64, out + 3 - off + 8, n/2);
+                memset(out + off, off*40, n/3);
+                for(u32 i=0;i<sizeof(ref);i++) if(ref[i] != out[i]){ bad++; break; }
+            }
+    return bad;
+}
+
+static int differ(const unsigned char *a, const unsigned char *b, u32 n){
+    for(u32 i=0;i<n;i++) if(a[i] != b[i]) return 1;
+    return 0;
+}
+
+// the same around NT, where the sse2 copy and fill switch to streaming
+// stores, with unaligned destinations and lengths
+static int check_big(void){
+    static const u32 sizes[] = { NT - 1, NT, NT + 1, NT + 15, NT + 4097, 3*NT/2 + 13 };
+    static const u32 offs[] = { 0, 1, 3, 8, 13 };
+    u32 cap = 2*NT + 64;
+    unsigned char *ref = malloc(cap), *out = malloc(cap);
+    int bad = 0;
+    if(!ref || !out) return 1;
+    for(int impl=STRING_REP;impl<NIMPL;impl++)
+        for(u32 k=0;k<sizeof(sizes)/sizeof(sizes[0]);k++)
+            for(u32 j=0;j<sizeof(offs)/sizeof(offs[0]);j++){
+                u32 n = sizes[k], off = offs[j];
+                for(int op=0;op<2;op++){
+                    for(u32 i=0;i<cap;i++) ref[i] = out[i] = (unsigned char)(i*7 + off);
+                    string_set_impl(STRING_BYTE);
+                    if(op) memset(ref + off, 0xA5, n); else memcpy(ref + off, src + 5, n);
+                    string_set_impl(impl);
+                    if(op) memset(out + off, 0xA5, n); else memcpy(out + off, src + 5, n);
+                    bad += differ(ref, out, cap);
+                }
+            }
+    free(ref);
+    free(out);
+    return bad;
+}
+
+// the loops string.c had before the word/SSE2 scans
+static u32 old_strlen(const char* s){u32 L=0;while(s[L])L++;return L;}
+static char *old_strstr(const char *haystack, const char *needle) {
+    if (!*needle) return (char*)haystack;
+    for (; *haystack; haystack++) {
+        const char *h = haystack;
+        const char *n = needle;
+        while (*h && *n && *h == *n) { h++; n++; }
+        if (!*n) return (char*)haystack;
+    }
+    return NULL;
+}
+
+static const void *old_memchr(const void *s, int c, u32 n){
+    const unsigned char *p = s;
+    for(u32 i=0;i<n;i++) if(p[i] == (unsigned char)c) return p + i;
+    return NULL;
+}
+static const char *old_strchr(const char *s, int c){
+    for(;; s++){ if(*s == (char)c) return s; if(!*s) return NULL; }
+}
+static const void *old_memmem(const void *hay, u32 hl, const void *needle, u32 nl){
+    const unsigned char *h = hay, *n = needle;
+    if(!nl) return h;
+    for(u32 i=0;i + nl <= hl;i++){
+        u32 k = 0;
+        while(k < nl && h[i + k] == n[k]) k++;
+        if(k == nl) return h + i;
+    }
+    return NULL;
+}
+
+/* The word and SSE2 scans against the loops above: random text over a
+ * few letters (0x80 and 0x01 to provoke false hits in the word test),
+ * NULs in the middle, random start offsets, needles of 1-5 bytes taken
+ * from the text or made up. */
+static int check_scans(void){
+    static unsigned char buf[4096 + 64];
+    static const unsigned char letters[] = { 'a', 'b', 0x80, 0x01, 0xFF };
+    unsigned rng = 12345;
+    int bad = 0;
+#define RND() (rng = rng*1103515245u + 12345u, rng >> 8)
+    for(int simd=0;simd<2;simd++){
+        string_set_simd(simd);
+        for(int it=0;it<40000;it++){
+            u32 off = RND() % 32, n = RND() % 8 ? RND() % 300 : RND() % 4000;
+            int nalpha = 2 + RND() % 4;
+            for(u32 i=0;i<sizeof(buf);i++) buf[i] = letters[RND() % nalpha];
+            u32 nuls = RND() % 3;
+            for(u32 k=0;k<nuls;k++) buf[off + RND() % (n + 1)] = 0;
+            buf[off + n] = 0;
+            buf[sizeof(buf) - 1] = 0;
+            const char *t = (const char*)buf + off;
+            unsigned char needle[6];
+            u32 nl = 1 + RND() % 5;
+            if(n >= nl && RND() % 2){
+                u32 at = RND() % (n - nl + 1);
+                for(u32 k=0;k<nl;k++) needle[k] = buf[off + at + k];
+            }else for(u32 k=0;k<nl;k++) needle[k] = letters[RND() % nalpha];
+            needle[nl] = 0;
+            int c = RND() % 4 ? letters[RND() % nalpha] : 0;
+
+            if(strlen(t) != old_strlen(t)) bad++;
+            if(memchr(t, c, n) != old_memchr(t, c, n)) bad++;
+            if(strchr(t, c) != old_strchr(t, c)) bad++;
+            if(memmem(t, n, needle, nl) != old_memmem(t, n, needle, nl)) bad++;
+            if(strstr(t, (const char*)needle) != old_strstr(t, (const char*)needle)) bad++;
+        }
+    }
+#undef RND
+    return bad;
+}
+
+// strings whose terminator is the last byte before an unmapped page: a
+// scan that loads past the page it is on faults here
+static int check_page_end(void){
+    unsigned char *pg = mmap(0, 8192, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(pg == MAP_FAILED || mprotect(pg + 4096, 4096, PROT_NONE)) return 1;
+    memset(pg, 'a', 4096);
+    pg[4095] = 0;
+    int bad = 0;
+    for(int simd=0;simd<2;simd++){
+        string_set_simd(simd);
+        for(u32 len=0;len<600;len++){
+            const char *t = (const char*)pg + 4095 - len;
+            if(strlen(t) != len) bad++;
+            if(strchr(t, 'b') != 0 || strchr(t, 0) != t + len) bad++;
+            if(memchr(t, 'b', len + 1) != 0) bad++;
+        }
+    }
+    munmap(pg, 8192);
+    return bad;
+}
+
+enum { SC_STRLEN, SC_MEMCHR, SC_MEMMEM, SC_STRSTR, NSCANS };
+static const char *const scan_name[] = {
+    "strlen", "memchr (no match)", "memmem \"\\r\\n\\r\\n\" (at the end)", "strstr \"\\\"title\\\"\" (at the end)"
+};
+
+// impl: 0 old loops, 1 words, 2 sse2; src holds n letters of HTTP-ish
+// text, the needle and a NUL
+static double run_scan(int sc, int impl, u32 n){
+    long calls = (64l << 20)/n;
+    if(calls < 4) calls = 4;
+    const char *t = (const char*)src;
+    volatile u32 sink = 0;
+    string_set_simd(impl == 2);
+    double t0 = now_ns();
+    for(long i=0;i<calls;i++){
+        switch(sc){
+        case SC_STRLEN: sink += impl ? strlen(t) : old_strlen(t); break;
+        case SC_MEMCHR: sink += memchr(t, '#', n) != 0; break;
+        case SC_MEMMEM: sink += memmem(t, n + 4, "\r\n\r\n", 4) != 0; break;
+        case SC_STRSTR: sink += (impl ? strstr(t, "\"title\"") : old_strstr(t, "\"title\"")) != 0; break;
+        }
+    }
+    double t1 = now_ns();
+    return (double)calls*n/(t1 - t0);
+}
+
+static void fill_text(u32 n, const char *needle){
+    const char *words = "Content-Type: application/json; charset=utf-8\r\n\"body\": ";
+    u32 i = 0, k = 0;
+    for(; i < n; i++, k++){ if(!words[k]) k = 0; src[i] = (unsigned char)words[k]; }
+    for(k=0; needle[k]; k++) src[i++] = (unsigned char)needle[k];
+    src[i] = 0;
+}
+
+int main(void){
+    src = aligned_alloc(64, MAXSZ + 64);
+    dst = aligned_alloc(64, MAXSZ + 64);
+    if(!src || !dst) return 1;
+    for(u32 i=0;i<MAXSZ + 64;i++) src[i] = dst[i] = (unsigned char)i;
+    if(check() || check_big() || check_scans() || check_page_end()){ fprintf(stderr, "string_bench: implementations disagree\n"); return 1; }
+
+    for(int op=0;op<NOPS;op++){
+        printf("%s, GB/s\n%10s", op_name[op], "size");
+        for(int impl=0;impl<NIMPL;impl++){
+            string_set_impl(impl);
+            printf("%9s", string_impl_name());
+        }
+        printf("\n");
+        for(u32 n=8;n<=MAXSZ;n *= 4){
+            printf("%10u", n);
+            for(int impl=0;impl<NIMPL;impl++){
+                string_set_impl(impl);
+                run(op, n);                         // warm up
+                printf("%9.2f", run(op, n));
+            }
+            printf("\n");
+        }
+        printf("\n");
+    }
+
+    for(int sc=0;sc<NSCANS;sc++){
+        printf("%s, GB/s\n%10s%9s%9s%9s\n", scan_name[sc], "size", "byte", "words", "sse2");
+        for(u32 n=64;n<=MAXSZ/2;n *= 4){
+            fill_text(n, sc == SC_STRSTR ? "\"title\"" : "\r\n\r\n");
+            printf("%10u", n);
+            for(int impl=0;impl<3;impl++){
+                if(impl == 0 && (sc == SC_MEMCHR || sc == SC_MEMMEM)){ printf("%9s", "-"); continue; }
+                run_scan(sc, impl, n);
+                printf("%9.2f", run_scan(sc, impl, n));
+            }
+            printf("\n");
+        }
+        printf("\n");
+    }
+    return 0;
+}
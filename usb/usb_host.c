@@ -74,7 +74,8 @@ int usb_control_transfer(struct usb_device *dev, uint8_t bmRequestType, uint8_t
                                              void *data, uintptr_t data_phys, int data_len, int direction_in);
     extern int xhci_submit_command_ring(int trb_count, void *user_buf, void *data_v, int data_len, int direction_in);
     extern void xhci_dump_cmd_ring(int n);
-    extern void *kmalloc(size_t sz);
+    extern void *xhci_xfer_alloc(int len, uintptr_t *phys);
+    extern void xhci_xfer_free(void *v, int len);
 
     uint8_t setup[8];
     setup[0] = bmRequestType;
@@ -86,39 +87,37 @@ int usb_control_transfer(struct usb_device *dev, uint8_t bmRequestType, uint8_t
     setup[6] = (uint8_t)(wLength & 0xff);
     setup[7] = (uint8_t)((wLength>>8) & 0xff);
 
-    /* In a real implementation we must provide a physical address for the setup packet
-     * and data buffers. For now we use simple kmalloc and assume identity mapping
-     * of virtual->physical (VIRT_TO_PHYS or flat mapping in this kernel).
-     */
-    void *setup_v = kmalloc(8);
+    /* setup packet and data go through reusable DMA buffers owned by xhci.c */
+    uintptr_t setup_phys;
+    void *setup_v = xhci_xfer_alloc(8, &setup_phys);
     if(!setup_v) return -1;
     for(int i=0;i<8;i++) ((uint8_t*)setup_v)[i] = setup[i];
-    uintptr_t setup_phys = (uintptr_t)setup_v;
 
     uintptr_t data_phys = 0;
     void *data_v = NULL;
     if(wLength>0 && data){
-        data_v = kmalloc(wLength);
-        if(!data_v) return -1;
+        data_v = xhci_xfer_alloc(wLength, &data_phys);
+        if(!data_v){ xhci_xfer_free(setup_v, 8); return -1; }
         if((bmRequestType & 0x80) == 0x80){ /* IN */
             /* For IN, we just prepare buffer for controller to write into */
         } else {
             /* For OUT, copy data to buffer */
             for(int i=0;i<wLength;i++) ((uint8_t*)data_v)[i] = ((uint8_t*)data)[i];
         }
-        data_phys = (uintptr_t)data_v;
     }
 
     int direction_in = ((bmRequestType & 0x80) == 0x80);
     int trbs = xhci_prepare_control_transfer(setup_v, setup_phys, data_v, data_phys, wLength, direction_in);
-    if(trbs<0) return -1;
+    if(trbs<0){ xhci_xfer_free(setup_v, 8); xhci_xfer_free(data_v, wLength); return -1; }
     xhci_dump_cmd_ring(trbs);
     /* Submit and wait for completion; pass user buffer so IN data can be copied back. */
     int r = xhci_submit_command_ring(trbs, data, data_v, (int)wLength, direction_in);
+    /* -2 (XHCI_ABANDONED): timed out with the TRBs still owned by the
+     * controller, which may yet DMA into the buffers; leak them */
+    if(r == -2){ printf("usb: control transfer timed out, leaking its buffers\n"); return -1; }
     /* free temporary buffers after submit returns (driver copies IN data back on completion) */
-    extern void free(void*);
-    if(setup_v) free(setup_v);
-    if(data_v) free(data_v);
+    xhci_xfer_free(setup_v, 8);
+    xhci_xfer_free(data_v, wLength);
     if(r<0) return -1;
     /* In dry-run mode xhci_submit_command_ring returns 0; indicate success for control transfers */
     return (int)wLength;
@@ -2,8 +2,8 @@
 #include "pci.h"
 #include "stdio.h"
 #include <stdint.h>
-/* allocator provided by kernel */
-void *kmalloc(size_t sz);
+#include "dma.h"
+#include "heap.h"
 
 /* runtime gate: set to 1 to allow actual hardware writes (DANGEROUS). Default 0. */
 int xhci_hw_enable = 1; /* ENABLED: set to 1 for VM passthrough testing; be careful on bare-metal */
@@ -16,6 +16,7 @@ int xhci_hw_enable = 1; /* ENABLED: set to 1 for VM passthrough testing; be care
  */
 #include <stdarg.h>
 #include "io.h"
+#include "ktime.h"
 extern int vsnprintf(char *buf, size_t size, const char *fmt, va_list ap);
 static void uart_init_once(void){
     static int inited = 0;
@@ -135,6 +136,45 @@ static uintptr_t ep0_ring_phys = 0;
 static void *ep0_rst = NULL;
 static uintptr_t ep0_rst_phys = 0;
 
+/* DMA memory. xHCI structures may not cross a 64 KiB boundary; controller
+ * structures (rings, DCBAA, contexts, ERST) are whole zeroed pages, and
+ * control-transfer buffers come from pools so they are reused. */
+#define XHCI_BOUNDARY  0x10000
+#define XHCI_XFER_SIZE 512
+static dma_pool_t *setup_pool = NULL, *xfer_pool = NULL;
+
+static void *xhci_page(uintptr_t *phys){
+    u32 p = 0;
+    void *v = dma_alloc(4096, 4096, XHCI_BOUNDARY, &p);
+    *phys = p;
+    return v;
+}
+
+/* Transfer buffers: up to XHCI_XFER_SIZE from the pool, larger ones whole
+ * pages; free with the same length. */
+void *xhci_xfer_alloc(int len, uintptr_t *phys){
+    u32 p = 0;
+    void *v;
+    if(len <= 8){
+        if(!setup_pool) setup_pool = dma_pool_create("xhci-setup", 8, 16, XHCI_BOUNDARY);
+        v = setup_pool ? dma_pool_alloc(setup_pool, &p) : NULL;
+    }else if(len <= XHCI_XFER_SIZE){
+        if(!xfer_pool) xfer_pool = dma_pool_create("xhci-xfer", XHCI_XFER_SIZE, 64, XHCI_BOUNDARY);
+        v = xfer_pool ? dma_pool_alloc(xfer_pool, &p) : NULL;
+    }else{
+        v = dma_alloc((u32)len, 64, XHCI_BOUNDARY, &p);
+    }
+    *phys = p;
+    return v;
+}
+
+void xhci_xfer_free(void *v, int len){
+    if(!v) return;
+    if(len <= 8) dma_pool_free(setup_pool, v);
+    else if(len <= XHCI_XFER_SIZE) dma_pool_free(xfer_pool, v);
+    else dma_free(v, (u32)len);
+}
+
 /* helpers to perform slot enable / device context initialization
  * These are minimal, conservative implementations that prepare local state
  * and populate the allocated device context page with safe defaults.
@@ -165,16 +205,10 @@ int xhci_poll_event_ring(int timeout_ms, void *data_v, void *user_buf, int data_
 int xhci_init_command_ring(void){
     if(cmd_ring) return 0;
     /* allocate a contiguous buffer for TRBs (not high-performance DMA mapping) */
-    size_t sz = XHCI_CMD_RING_TRBS * sizeof(struct xhci_trb);
-    void *p = kmalloc(sz);
+    void *p = dma_alloc(XHCI_CMD_RING_TRBS * sizeof(struct xhci_trb), 64, XHCI_BOUNDARY, NULL);
     if(!p) return -1;
     cmd_ring = (struct xhci_trb*)p;
-    /* In this simple kernel environment VIRT_TO_PHYS may be a macro; fallback to cast */
-#ifdef VIRT_TO_PHYS
-    cmd_ring_phys = (uintptr_t)VIRT_TO_PHYS(cmd_ring);
-#else
-    cmd_ring_phys = (uintptr_t)(uintptr_t)cmd_ring;
-#endif
+    cmd_ring_phys = dma_phys(cmd_ring);
     /* zero ring */
     for(size_t i=0;i< (size_t)XHCI_CMD_RING_TRBS;i++){
         cmd_ring[i].a = cmd_ring[i].b = cmd_ring[i].c = cmd_ring[i].d = 0;
@@ -302,7 +336,12 @@ int xhci_prepare_control_transfer(const void *setup8, uintptr_t setup_phys,
 /* Submit the prepared command ring to the controller. NOT IMPLEMENTED: this
  * currently only logs the planned submission. Real submission requires
  * writing CRCR/doorbells and handling event ring completions.
+ * Returns XHCI_ABANDONED when the doorbell was rung but no completion came:
+ * the controller may still fetch the TRBs and DMA into their buffers, so
+ * the caller must not hand those buffers out again.
  */
+#define XHCI_ABANDONED (-2)
+
 int xhci_submit_command_ring(int trb_count, void *user_buf, void *data_v, int data_len, int direction_in){
     serial_puts("usb/xhci: submit_command_ring trb_count="); serial_putdec((uint32_t)trb_count);
     serial_puts(" phys=0x"); serial_puthex32((uint32_t)cmd_ring_phys);
@@ -332,26 +371,14 @@ int xhci_submit_command_ring(int trb_count, void *user_buf, void *data_v, int da
      * - ring doorbell for command ring and poll for completion via event ring
      */
     if(!g_dcbaa){
-    g_dcbaa = kmalloc(4096);
+    g_dcbaa = xhci_page(&g_dcbaa_phys);
     if(!g_dcbaa) return -1;
-#ifdef VIRT_TO_PHYS
-    g_dcbaa_phys = (uintptr_t)VIRT_TO_PHYS(g_dcbaa);
-#else
-    g_dcbaa_phys = (uintptr_t)g_dcbaa;
-#endif
-    /* zero DCBAA */
-    for(size_t i=0;i<4096/sizeof(uintptr_t);i++) ((uintptr_t*)g_dcbaa)[i]=0;
     }
-    /* allocate and zero a device context page for slot 1 */
-
-    g_dev_ctx = kmalloc(4096);
+    /* a zeroed device context page for slot 1, allocated once */
+    if(!g_dev_ctx){
+    g_dev_ctx = xhci_page(&g_dev_ctx_phys);
     if(!g_dev_ctx) return -1;
-#ifdef VIRT_TO_PHYS
-    g_dev_ctx_phys = (uintptr_t)VIRT_TO_PHYS(g_dev_ctx);
-#else
-    g_dev_ctx_phys = (uintptr_t)g_dev_ctx;
-#endif
-    for(size_t i=0;i<4096/sizeof(uint32_t);i++) ((uint32_t*)g_dev_ctx)[i]=0;
+    }
 
     /* place the device context physical address into DCBAA entry 1 (slot 1)
      * per xHCI DCBAA layout (index 0 reserved). */
@@ -440,7 +467,7 @@ int xhci_submit_command_ring(int trb_count, void *user_buf, void *data_v, int da
     serial_puts(" high=0x"); serial_puthex32(crcr_hi_rb);
     serial_puts(" USBSTS=0x"); serial_puthex32(usbsts_rb); serial_puts("\n");
     /* small delay after CRCR/ERDP programming to give controller time to observe pointers */
-    for(volatile int z=0; z<10000; z++);
+    udelay(100);
     /* ring doorbell for command ring (db 0). Value is 0 for command ring in many controllers. */
     xhci_ring_doorbell(0, 0);
     /* read back USBSTS/CRCR after ringing doorbell */
@@ -452,6 +479,7 @@ int xhci_submit_command_ring(int trb_count, void *user_buf, void *data_v, int da
     serial_puts(" USBSTS=0x"); serial_puthex32(usbsts_rb); serial_puts("\n");
     int r = xhci_poll_event_ring(500, data_v, user_buf, data_len, direction_in);
         if(r==0) serial_puts("usb/xhci: completion detected\n"); else serial_puts("usb/xhci: completion timeout\n");
+        if(r!=0) return XHCI_ABANDONED;
     }
     return 0;
 }
@@ -490,27 +518,12 @@ static uint32_t er_expected_cycle = 1;
 int xhci_init_event_ring(void){
     if(er_buffer) return 0;
     /* allocate one page for event ring buffer */
-    void *p = kmalloc(4096);
-    if(!p) return -1;
-    er_buffer = p;
-#ifdef VIRT_TO_PHYS
-    er_buffer_phys = (uintptr_t)VIRT_TO_PHYS(er_buffer);
-#else
-    er_buffer_phys = (uintptr_t)er_buffer;
-#endif
-    /* zero buffer */
-    for(size_t i=0;i<4096/sizeof(uint32_t);i++) ((uint32_t*)er_buffer)[i]=0;
-
-    /* allocate a small ERST (we'll keep one entry) */
-    void *s = kmalloc(4096);
-    if(!s) return -1;
-    erst = s;
-#ifdef VIRT_TO_PHYS
-    erst_phys = (uintptr_t)VIRT_TO_PHYS(erst);
-#else
-    erst_phys = (uintptr_t)erst;
-#endif
-    for(size_t i=0;i<4096/sizeof(uint32_t);i++) ((uint32_t*)erst)[i]=0;
+    er_buffer = xhci_page(&er_buffer_phys);
+    if(!er_buffer) return -1;
+
+    /* a small ERST (we'll keep one entry) */
+    erst = xhci_page(&erst_phys);
+    if(!erst) return -1;
     erst_size = 1; /* one segment */
     /* Populate ERST first entry: qword base address + dword segment size
      * Per xHCI ERST entry layout: [0x0] qword Segment Base Address
@@ -585,7 +598,7 @@ int xhci_send_enable_slot(void){
     uint32_t usbsts_rb = xhci_op_read32(0x04);
     serial_puts("usb/xhci: USBSTS=0x"); serial_puthex32(usbsts_rb); serial_puts("\n");
     /* give controller a short time to observe CRCR/ERDP before doorbell */
-    for(volatile int z=0; z<10000; z++);
+    udelay(100);
     xhci_ring_doorbell(0, 0);
 
     /* Wait for a command completion event. Our event parser treats any
@@ -606,7 +619,7 @@ int xhci_send_enable_slot(void){
         serial_puts("usb/xhci: enable-slot attempt timed out, dumping ER state\n");
         xhci_dump_event_ring();
         /* small pause before retry */
-        for(volatile int z=0; z<1000000; z++);
+        mdelay(10);
     }
     serial_puts("usb/xhci: enable-slot command failed after retries\n");
     /* Try alternate CRCR sequence: write pointer without flags, small delay, then set flags. */
@@ -616,7 +629,7 @@ int xhci_send_enable_slot(void){
     xhci_op_write32(0x18, (uint32_t)(crcr_ptr & 0xFFFFFFFFu));
     xhci_op_write32(0x1C, (uint32_t)((crcr_ptr>>32)&0xFFFFFFFFu));
     /* small delay */
-    for(volatile int z=0; z<100000; z++);
+    mdelay(1);
     /* now set the low flags (CRR) by ORing in 1 */
     uint32_t crcr_lo_now = xhci_op_read32(0x18);
     xhci_op_write32(0x18, crcr_lo_now | 1);
@@ -662,30 +675,9 @@ int xhci_init_device_context(void){
 
     /* Ensure an EP0 ring exists */
     if(!ep0_ring){
-        ep0_ring = kmalloc(4096);
-        if(ep0_ring){
-#ifdef VIRT_TO_PHYS
-            ep0_ring_phys = (uintptr_t)VIRT_TO_PHYS(ep0_ring);
-#else
-            ep0_ring_phys = (uintptr_t)ep0_ring;
-#endif
-            for(size_t i=0;i<4096/sizeof(uint32_t);i++) ((uint32_t*)ep0_ring)[i]=0;
-            /* set first TRB cycle bit so some controllers see a valid TRB */
-            ((uint32_t*)ep0_ring)[3] = XHCI_TRB_CYCLE_BIT;
-        }
-    }
-    if(!ep0_ring){
-        ep0_ring = kmalloc(4096);
-        if(ep0_ring){
-#ifdef VIRT_TO_PHYS
-            ep0_ring_phys = (uintptr_t)VIRT_TO_PHYS(ep0_ring);
-#else
-            ep0_ring_phys = (uintptr_t)ep0_ring;
-#endif
-            for(size_t i=0;i<4096/sizeof(uint32_t);i++) ((uint32_t*)ep0_ring)[i]=0;
-            /* set first TRB cycle bit so some controllers see a valid TRB */
-            ((uint32_t*)ep0_ring)[3] = XHCI_TRB_CYCLE_BIT;
-        }
+        ep0_ring = xhci_page(&ep0_ring_phys);
+        /* set first TRB cycle bit so some controllers see a valid TRB */
+        if(ep0_ring) ((uint32_t*)ep0_ring)[3] = XHCI_TRB_CYCLE_BIT;
     }
 
     /* Endpoint context start is at offset 0x20 within the device context per xHCI */
@@ -693,15 +685,8 @@ int xhci_init_device_context(void){
     if(ep0_ring_phys){
         /* Ensure an RST (Ring Segment Table) exists for EP0 and point it to the ring */
         if(!ep0_rst){
-            ep0_rst = kmalloc(4096);
+            ep0_rst = xhci_page(&ep0_rst_phys);
             if(ep0_rst){
-#ifdef VIRT_TO_PHYS
-                ep0_rst_phys = (uintptr_t)VIRT_TO_PHYS(ep0_rst);
-#else
-                ep0_rst_phys = (uintptr_t)ep0_rst;
-#endif
-                /* Zero RST and place one segment entry pointing at ep0_ring_phys */
-                for(size_t i=0;i<4096/sizeof(uint32_t);i++) ((uint32_t*)ep0_rst)[i]=0;
                 /* RST entry 0: segment base address (qword at offset 0) */
                 *((uint64_t*)((uintptr_t)ep0_rst + 0)) = (uint64_t)ep0_ring_phys;
             }
@@ -756,37 +741,36 @@ int xhci_control_transfer(uint8_t bmRequestType, uint8_t bRequest,
                           uint16_t wValue, uint16_t wIndex,
                           void *data, int data_len, int direction_in,
                           void *resp_buf, int resp_len){
-    struct usb_setup *s = (struct usb_setup*)kmalloc(sizeof(struct usb_setup));
+    uintptr_t s_phys;
+    struct usb_setup *s = (struct usb_setup*)xhci_xfer_alloc(sizeof(struct usb_setup), &s_phys);
     if(!s) return -1;
     s->bmRequestType = bmRequestType;
     s->bRequest = bRequest;
     s->wValue = wValue;
     s->wIndex = wIndex;
     s->wLength = (uint16_t)data_len;
-#ifdef VIRT_TO_PHYS
-    uintptr_t s_phys = (uintptr_t)VIRT_TO_PHYS(s);
-#else
-    uintptr_t s_phys = (uintptr_t)s;
-#endif
 
     uintptr_t data_phys = 0;
     void *data_v = NULL;
     if(data_len>0){
-        data_v = kmalloc(data_len);
-        if(!data_v) return -1;
+        data_v = xhci_xfer_alloc(data_len, &data_phys);
+        if(!data_v){ xhci_xfer_free(s, sizeof(struct usb_setup)); return -1; }
         /* caller provided buffer may be used as initial data for OUT; copy if present */
         if(!direction_in && data) for(int i=0;i<data_len;i++) ((uint8_t*)data_v)[i]=((uint8_t*)data)[i];
-#ifdef VIRT_TO_PHYS
-        data_phys = (uintptr_t)VIRT_TO_PHYS(data_v);
-#else
-        data_phys = (uintptr_t)data_v;
-#endif
     }
 
+    int r = -1;
     int trbs = xhci_prepare_control_transfer((const void*)s, s_phys, data_v, data_phys, data_len, direction_in);
-    if(trbs<0) return -1;
-
-    int r = xhci_submit_command_ring(trbs, resp_buf, data_v, data_len, direction_in);
+    if(trbs>=0) r = xhci_submit_command_ring(trbs, resp_buf, data_v, data_len, direction_in);
+    if(r == XHCI_ABANDONED){
+        /* nothing stops the endpoint yet, so the buffers stay with the
+         * controller for good rather than going back to the pools */
+        serial_puts("usb/xhci: control transfer timed out, leaking its buffers\n");
+        return -1;
+    }
+    /* the transfer is complete here; IN data was copied out */
+    xhci_xfer_free(data_v, data_len);
+    xhci_xfer_free(s, sizeof(struct usb_setup));
     return r;
 }
 
@@ -867,7 +851,7 @@ int xhci_enumerate_once(void){
                     } else {
                         serial_puts("usb/xhci: failed to fetch full config descriptor second pass\n");
                     }
-                    /* keep full descriptor in memory for debugging if desired */
+                    kfree(full);
                 } else {
                     serial_puts("usb/xhci: failed to allocate buffer for full config descriptor\n");
                 }
@@ -999,11 +983,11 @@ int xhci_program_event_ring(void){
         xhci_op_write32(B + 0x04, (uint32_t)(((uint64_t)erst_phys>>32)&0xFFFFFFFFu));
         xhci_op_write32(B + 0x08, (uint32_t)erst_size);
         /* small delay */
-        for(volatile int z=0; z<1000; z++);
+        udelay(10);
         /* Step 1: write ERDP pointer without cycle bit to probe readback */
         xhci_op_write32(B + 0x10, erdp_ptr_low & ~0x1u);
         xhci_op_write32(B + 0x14, erdp_ptr_hi);
-        for(volatile int z=0; z<2000; z++);
+        udelay(20);
         /* read back to see if the controller reflects the written pointers */
         uint32_t erst_lo_rb = xhci_op_read32(B + 0x00);
         uint32_t erst_hi_rb = xhci_op_read32(B + 0x04);
@@ -1026,7 +1010,7 @@ int xhci_program_event_ring(void){
             serial_puts("usb/xhci: setting IMOD then enabling IMAN at base 0x"); serial_puthex32(B); serial_puts("\n");
             /* Conservative IMOD value: a small value to avoid flooding */
             xhci_op_write32(B + 0x04, 0x100u);
-            for(volatile int z=0; z<500; z++);
+            udelay(5);
             xhci_op_write32(B + 0x00, 0x1u);
             uint32_t iman_rb = xhci_op_read32(B + 0x00);
             uint32_t imod_rb = xhci_op_read32(B + 0x04);
@@ -1051,10 +1035,10 @@ int xhci_program_event_ring(void){
         xhci_op_write32(0x20, (uint32_t)(erst_phys & 0xFFFFFFFFu));
         xhci_op_write32(0x24, (uint32_t)(((uint64_t)erst_phys>>32)&0xFFFFFFFFu));
         xhci_op_write32(0x28, (uint32_t)erst_size);
-        for(volatile int z=0; z<10000; z++);
+        udelay(100);
         xhci_op_write32(0x30, erdp_ptr_low & ~0x1u);
         xhci_op_write32(0x34, erdp_ptr_hi);
-        for(volatile int z=0; z<20000; z++);
+        udelay(200);
         uint32_t erdp_lo_rb = xhci_op_read32(0x30);
         uint32_t erdp_hi_rb = xhci_op_read32(0x34);
         uint32_t usbsts_rb  = xhci_op_read32(0x04);
@@ -1072,7 +1056,7 @@ int xhci_program_event_ring(void){
     /* Try 0x30/0x34 (already used in many controllers) */
     xhci_op_write32(0x30, erdp_ptr_low & ~0x1u);
     xhci_op_write32(0x34, erdp_ptr_hi);
-    for(volatile int z=0; z<15000; z++);
+    udelay(150);
     {
         uint32_t rb30 = xhci_op_read32(0x30);
         uint32_t rb34 = xhci_op_read32(0x34);
@@ -1080,7 +1064,7 @@ int xhci_program_event_ring(void){
         serial_puts(" rb_hi=0x"); serial_puthex32(rb34); serial_puts("\n");
     }
     xhci_op_write32(0x30, (erdp_ptr_low | (er_expected_cycle & 0x1u)));
-    for(volatile int z=0; z<5000; z++);
+    udelay(50);
     {
         uint32_t rb30 = xhci_op_read32(0x30);
         uint32_t rb34 = xhci_op_read32(0x34);
@@ -1090,7 +1074,7 @@ int xhci_program_event_ring(void){
     /* Try 0x38/0x3C as another candidate */
     xhci_op_write32(0x38, erdp_ptr_low & ~0x1u);
     xhci_op_write32(0x3C, erdp_ptr_hi);
-    for(volatile int z=0; z<15000; z++);
+    udelay(150);
     {
         uint32_t rb38 = xhci_op_read32(0x38);
         uint32_t rb3c = xhci_op_read32(0x3C);
@@ -1098,7 +1082,7 @@ int xhci_program_event_ring(void){
         serial_puts(" rb_hi=0x"); serial_puthex32(rb3c); serial_puts("\n");
     }
     xhci_op_write32(0x38, (erdp_ptr_low | (er_expected_cycle & 0x1u)));
-    for(volatile int z=0; z<5000; z++);
+    udelay(50);
     {
         uint32_t rb38 = xhci_op_read32(0x38);
         uint32_t rb3c = xhci_op_read32(0x3C);
@@ -1127,9 +1111,9 @@ int xhci_poll_event_ring(int timeout_ms, void *data_v, void *user_buf, int data_
 
     volatile uint32_t *buf = (volatile uint32_t*)er_buffer;
     const int max_trbs = 4096 / 16;
-    int loops = timeout_ms * 1000 / 10; /* 10us sleep granularity */
+    deadline_t end = ktime_deadline_ms((u32)timeout_ms);
 
-    for(int iter=0; iter<loops; ++iter){
+    for(;;){
         /* Check the dequeue position for a valid TRB with matching cycle bit */
         uint32_t idx = er_dequeue_idx;
         uint32_t dw3 = buf[idx*4 + 3];
@@ -1177,7 +1161,8 @@ int xhci_poll_event_ring(int timeout_ms, void *data_v, void *user_buf, int data_
         }
 
         /* no valid TRB at dequeue; small delay */
-        for(volatile int z=0;z<1000;z++);
+        if(ktime_expired(end)) break;
+        udelay(10);
     }
 
     return -1;
@@ -1194,9 +1179,9 @@ int xhci_wait_for_command_completion(int timeout_ms, int *out_code){
     if(!er_buffer) return -1;
     volatile uint32_t *buf = (volatile uint32_t*)er_buffer;
     const int max_trbs = 4096 / 16;
-    int loops = timeout_ms * 1000 / 10;
+    deadline_t end = ktime_deadline_ms((u32)timeout_ms);
 
-    for(int iter=0; iter<loops; ++iter){
+    for(;;){
         uint32_t idx = er_dequeue_idx;
         uint32_t dw3 = buf[idx*4 + 3];
         uint32_t trb_cycle = dw3 & 0x1u;
@@ -1279,7 +1264,8 @@ int xhci_wait_for_command_completion(int timeout_ms, int *out_code){
             xhci_op_write32(0x30, erdp2_low);
             xhci_op_write32(0x34, (uint32_t)(((uint64_t)erdp2>>32)&0xFFFFFFFFu));
         }
-        for(volatile int z=0;z<1000;z++);
+        if(ktime_expired(end)) break;
+        udelay(10);
     }
     return -1;
 }
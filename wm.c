@@ -0,0 +1,294 @@
+// wm.c — retained-mode window manager on top of graphics.c
+#include "wm.h"
+#include "heap.h"
+
+/* Every window owns an off-screen surface holding all of its pixels, so the
+ * screen can be rebuilt from the surfaces at any time. Repaints walk the
+ * z-order and split the requested area around each window they meet: a
+ * pixel is copied exactly once, from the topmost window covering it, and
+ * occluded pixels are never touched. */
+static wm_window_t windows[WM_MAX_WINDOWS];
+static wm_window_t *order[WM_MAX_WINDOWS];   // bottom .. top
+static int count = 0;
+static u32 background = 0;
+static const gfx_font_t *title_font = 0;   // NULL: built-in 8x8
+
+/* Hit-test index: a coarse grid of 64x64 cells, each holding a bitmask of
+ * the windows that overlap it, so a lookup only tests windows that can
+ * actually contain the point. */
+#define CELL_SHIFT 6
+static u16 *grid = 0;
+static int grid_cols = 0, grid_rows = 0;
+
+#define CLOSE_SIZE 20
+#define CLOSE_X(w) ((w) - 26)
+#define CLOSE_Y    5
+
+static inline gfx_rect_t win_rect(const wm_window_t *w){
+    gfx_rect_t r = { w->x, w->y, w->x + w->w, w->y + w->h };
+    return r;
+}
+
+static inline int rect_empty(const gfx_rect_t *r){ return r->x0 >= r->x1 || r->y0 >= r->y1; }
+
+static inline gfx_rect_t rect_isect(gfx_rect_t a, gfx_rect_t b){
+    if(b.x0 > a.x0) a.x0 = b.x0;
+    if(b.y0 > a.y0) a.y0 = b.y0;
+    if(b.x1 < a.x1) a.x1 = b.x1;
+    if(b.y1 < a.y1) a.y1 = b.y1;
+    return a;
+}
+
+// r minus o (o inside r) as up to four disjoint bands
+static int rect_split(const gfx_rect_t *r, const gfx_rect_t *o, gfx_rect_t out[4]){
+    int n = 0;
+    if(r->y0 < o->y0){ gfx_rect_t t = { r->x0, r->y0, r->x1, o->y0 }; out[n++] = t; }
+    if(o->y1 < r->y1){ gfx_rect_t t = { r->x0, o->y1, r->x1, r->y1 }; out[n++] = t; }
+    if(r->x0 < o->x0){ gfx_rect_t t = { r->x0, o->y0, o->x0, o->y1 }; out[n++] = t; }
+    if(o->x1 < r->x1){ gfx_rect_t t = { o->x1, o->y0, r->x1, o->y1 }; out[n++] = t; }
+    return n;
+}
+
+static int z_of(const wm_window_t *w){
+    for(int i=0;i<count;i++) if(order[i] == w) return i;
+    return -1;
+}
+
+/* Repaint screen area r. Windows order[above..count-1] are unchanged, so
+ * whatever they cover is left alone; the rest is filled from order[z] down
+ * to the background. */
+static void repaint(gfx_rect_t r, int z, int above){
+    gfx_rect_t scr = { 0, 0, (int)framebuffer_width, (int)framebuffer_height };
+    gfx_rect_t part[4];
+    r = rect_isect(r, scr);
+    if(rect_empty(&r)) return;
+
+    for(int i=above;i<count;i++){
+        gfx_rect_t o = rect_isect(r, win_rect(order[i]));
+        if(rect_empty(&o)) continue;
+        int n = rect_split(&r, &o, part);
+        for(int k=0;k<n;k++) repaint(part[k], z, i+1);
+        return;
+    }
+    for(int i=z;i>=0;i--){
+        const wm_window_t *w = order[i];
+        gfx_rect_t o = rect_isect(r, win_rect(w));
+        if(rect_empty(&o)) continue;
+        gfx_blit(o.x0, o.y0, o.x1 - o.x0, o.y1 - o.y0,
+                 w->surf.pixels + (o.y0 - w->y)*w->w + (o.x0 - w->x), w->w);
+        int n = rect_split(&r, &o, part);
+        for(int k=0;k<n;k++) repaint(part[k], i-1, count);
+        return;
+    }
+    draw_rect(r.x0, r.y0, r.x1 - r.x0, r.y1 - r.y0, background);
+}
+
+// repaint() with the screen back buffer as the drawing target
+static void repaint_screen(gfx_rect_t r, int z, int above){
+    gfx_surface_t *prev = gfx_set_target(0);
+    repaint(r, z, above);
+    gfx_set_target(prev);
+}
+
+static void grid_update(const wm_window_t *w, int set){
+    if(!grid) return;
+    u16 bit = (u16)(1u << (w - windows));
+    int c0 = w->x < 0 ? 0 : w->x >> CELL_SHIFT;
+    int r0 = w->y < 0 ? 0 : w->y >> CELL_SHIFT;
+    int c1 = (w->x + w->w - 1) >> CELL_SHIFT;
+    int r1 = (w->y + w->h - 1) >> CELL_SHIFT;
+    if(c1 >= grid_cols) c1 = grid_cols - 1;
+    if(r1 >= grid_rows) r1 = grid_rows - 1;
+    for(int r=r0;r<=r1;r++)
+        for(int c=c0;c<=c1;c++){
+            if(set) grid[r*grid_cols + c] |= bit;
+            else    grid[r*grid_cols + c] &= (u16)~bit;
+        }
+}
+
+// surface damage hook: accumulate what was drawn into the window
+static void surf_damage(gfx_surface_t *s,int x,int y,int w,int h){
+    wm_window_t *win = (wm_window_t*)((u8*)s - offsetof(wm_window_t, surf));
+    gfx_rect_t r = { x, y, x + w, y + h };
+    gfx_rect_t all = { 0, 0, s->width, s->height };
+    r = rect_isect(r, all);
+    if(rect_empty(&r)) return;
+    if(rect_empty(&win->dirty)){ win->dirty = r; return; }
+    if(r.x0 < win->dirty.x0) win->dirty.x0 = r.x0;
+    if(r.y0 < win->dirty.y0) win->dirty.y0 = r.y0;
+    if(r.x1 > win->dirty.x1) win->dirty.x1 = r.x1;
+    if(r.y1 > win->dirty.y1) win->dirty.y1 = r.y1;
+}
+
+void wm_init(u32 bg){
+    background = bg;
+    count = 0;
+    for(int i=0;i<WM_MAX_WINDOWS;i++) windows[i].used = 0;
+    if(!grid){
+        grid_cols = ((int)framebuffer_width  + (1 << CELL_SHIFT) - 1) >> CELL_SHIFT;
+        grid_rows = ((int)framebuffer_height + (1 << CELL_SHIFT) - 1) >> CELL_SHIFT;
+        grid = (u16*)kmalloc(grid_cols*grid_rows*sizeof(u16));
+    }
+    if(grid)
+        for(int i=0;i<grid_cols*grid_rows;i++) grid[i] = 0;
+    gfx_rect_t scr = { 0, 0, (int)framebuffer_width, (int)framebuffer_height };
+    repaint_screen(scr, -1, 0);
+}
+
+void wm_set_font(const gfx_font_t *f){ title_font = f; }
+
+wm_window_t *wm_create(int x,int y,int w,int h,int flags,const char *title,u32 bg){
+    if(w <= 0 || h <= 0 || count == WM_MAX_WINDOWS) return 0;
+    wm_window_t *win = 0;
+    for(int i=0;i<WM_MAX_WINDOWS && !win;i++)
+        if(!windows[i].used) win = &windows[i];
+
+    // a slot keeps its surface for the next window unless it is too small
+    u32 need = (u32)w*(u32)h;
+    if(win->cap < need){
+        kfree(win->surf.pixels);
+        win->surf.pixels = 0;
+        win->cap = 0;
+        u32 *px = (u32*)kmalloc(need*4);
+        if(!px) return 0;
+        win->surf.pixels = px;
+        win->cap = need;
+    }
+    win->used = 1;
+    win->x = x; win->y = y; win->w = w; win->h = h;
+    win->flags = flags;
+    win->title = title;
+    win->click = 0;
+    win->widgets = 0;
+    win->paint_pending = 0;
+    win->surf.width = w;
+    win->surf.height = h;
+    win->surf.damage = surf_damage;
+
+    gfx_surface_t *prev = gfx_set_target(&win->surf);
+    draw_rect(0, 0, w, h, bg);
+    if(!(flags & WM_UNDECORATED)){
+        draw_rect(0, 0, w, WM_TITLE_H, 0x1E90FF);
+        int th = title_font ? title_font->height : 8;
+        if(title) gfx_draw_text(title_font, 10, (WM_TITLE_H - th)/2, title, 0xFFFFFF);
+        draw_rect(CLOSE_X(w), CLOSE_Y, CLOSE_SIZE, CLOSE_SIZE, 0xFF0000);
+        draw_string(CLOSE_X(w) + 5, CLOSE_Y + 2, "X", 0xFFFFFF);
+    }
+    gfx_set_target(prev);
+    win->dirty.x0 = win->dirty.x1 = 0;   // shown in full below
+
+    order[count++] = win;
+    grid_update(win, 1);
+    repaint_screen(win_rect(win), count - 1, count);
+    return win;
+}
+
+void wm_destroy(wm_window_t *win){
+    int z = z_of(win);
+    if(z < 0) return;
+    grid_update(win, 0);
+    for(int i=z;i<count-1;i++) order[i] = order[i+1];
+    count--;
+    win->used = 0;
+    // windows that were above it keep their pixels; expose what it covered
+    repaint_screen(win_rect(win), z - 1, z);
+}
+
+void wm_raise(wm_window_t *win){
+    int z = z_of(win);
+    if(z < 0 || z == count - 1) return;
+    gfx_rect_t hidden[WM_MAX_WINDOWS];
+    int n = 0;
+    for(int i=z+1;i<count;i++){
+        gfx_rect_t o = rect_isect(win_rect(win), win_rect(order[i]));
+        if(!rect_empty(&o)) hidden[n++] = o;
+    }
+    for(int i=z;i<count-1;i++) order[i] = order[i+1];
+    order[count-1] = win;
+    // only the parts other windows were covering need to be copied
+    for(int i=0;i<n;i++) repaint_screen(hidden[i], count - 1, count);
+}
+
+void wm_move(wm_window_t *win,int x,int y){
+    int z = z_of(win);
+    if(z < 0 || (x == win->x && y == win->y)) return;
+    gfx_rect_t old = win_rect(win);
+    grid_update(win, 0);
+    win->x = x;
+    win->y = y;
+    grid_update(win, 1);
+
+    gfx_rect_t now = win_rect(win), part[4];
+    gfx_rect_t o = rect_isect(old, now);
+    if(rect_empty(&o)) repaint_screen(old, z - 1, z + 1);
+    else{
+        int n = rect_split(&old, &o, part);
+        for(int k=0;k<n;k++) repaint_screen(part[k], z - 1, z + 1);
+    }
+    repaint_screen(now, z, z + 1);
+}
+
+void wm_add_widget(wm_window_t *win,wm_widget_t *wg){
+    wg->win = win;
+    wg->next = win->widgets;
+    win->widgets = wg;
+    wm_invalidate(wg);
+}
+
+void wm_invalidate(wm_widget_t *wg){
+    wg->dirty = 1;
+    if(wg->win) wg->win->paint_pending = 1;
+}
+
+int wm_click(wm_window_t *win,int x,int y){
+    if(win->click){ win->click(win, x, y); return 1; }
+    for(wm_widget_t *wg = win->widgets; wg; wg = wg->next){
+        if(x < wg->x || y < wg->y || x >= wg->x + wg->w || y >= wg->y + wg->h) continue;
+        if(!wg->click) return 0;
+        wg->click(wg, x - wg->x, y - wg->y);
+        return 1;
+    }
+    return 0;
+}
+
+// paint the dirty widgets of a window into its surface
+static void paint_widgets(wm_window_t *w){
+    gfx_surface_t *prev = gfx_set_target(&w->surf);
+    w->paint_pending = 0;
+    for(wm_widget_t *wg = w->widgets; wg; wg = wg->next){
+        if(!wg->dirty) continue;
+        wg->dirty = 0;
+        wg->paint(wg);
+    }
+    gfx_set_target(prev);
+}
+
+void wm_compose(void){
+    for(int i=0;i<count;i++){
+        wm_window_t *w = order[i];
+        if(w->paint_pending) paint_widgets(w);
+        if(rect_empty(&w->dirty)) continue;
+        gfx_rect_t r = { w->x + w->dirty.x0, w->y + w->dirty.y0, w->x + w->dirty.x1, w->y + w->dirty.y1 };
+        w->dirty.x0 = w->dirty.x1 = 0;
+        repaint_screen(r, i, i + 1);
+    }
+}
+
+wm_window_t *wm_hit(int x,int y,int *lx,int *ly,int *part){
+    *part = WM_HIT_NONE;
+    if(!grid || x < 0 || y < 0 || x >= (int)framebuffer_width || y >= (int)framebuffer_height) return 0;
+    u16 mask = grid[(y >> CELL_SHIFT)*grid_cols + (x >> CELL_SHIFT)];
+    for(int i=count-1;i>=0 && mask;i--){
+        wm_window_t *w = order[i];
+        if(!(mask & (1u << (w - windows)))) continue;
+        if(x < w->x || y < w->y || x >= w->x + w->w || y >= w->y + w->h) continue;
+        *lx = x - w->x;
+        *ly = y - w->y;
+        if(w->flags & WM_UNDECORATED || *ly >= WM_TITLE_H) *part = WM_HIT_CLIENT;
+        else if(*lx >= CLOSE_X(w->w) && *lx < CLOSE_X(w->w) + CLOSE_SIZE &&
+                *ly >= CLOSE_Y && *ly < CLOSE_Y + CLOSE_SIZE) *part = WM_HIT_CLOSE;
+        else *part = WM_HIT_TITLE;
+        return w;
+    }
+    return 0;
+}
@@ -0,0 +1,68 @@
+#ifndef WM_H
+#define WM_H
+
+#include "graphics.h"
+
+#define WM_MAX_WINDOWS 16
+#define WM_TITLE_H     30
+
+// window flags
+#define WM_UNDECORATED 1   // no title bar / close box (desktop, popups)
+
+// wm_hit() results
+#define WM_HIT_NONE   0
+#define WM_HIT_CLIENT 1
+#define WM_HIT_TITLE  2
+#define WM_HIT_CLOSE  3
+
+typedef struct wm_window wm_window_t;
+typedef struct wm_widget wm_widget_t;
+
+// A widget is a rect of a window that repaints itself from its owner's
+// state. wm_invalidate() only sets a flag; the paint happens in the next
+// wm_compose(), so nothing is drawn while the state stays the same.
+struct wm_widget {
+    int x, y, w, h;             // window coordinates
+    int id;                     // free for the owner (key code, menu item, ...)
+    void (*paint)(wm_widget_t *wg);                 // target is the window surface
+    void (*click)(wm_widget_t *wg, int x, int y);   // widget coordinates; may be NULL
+    wm_window_t *win;
+    wm_widget_t *next;
+    int dirty;
+};
+
+struct wm_window {
+    int x, y, w, h;             // screen rect, decoration included
+    int flags;
+    const char *title;
+    gfx_surface_t surf;         // whole window, window coordinates
+    gfx_rect_t dirty;           // drawn since the last wm_compose(), window coordinates
+    void (*click)(wm_window_t *win, int x, int y);   // client click, window coordinates
+    wm_widget_t *widgets;
+    int paint_pending;          // some widget is dirty
+    u32 cap;                    // surface capacity in pixels, kept across reuse
+    int used;
+};
+
+// Windows are stacked bottom to top in creation order; everything below the
+// lowest window shows the background colour. Draw into a window with
+// gfx_set_target(&win->surf) or through widgets; wm_compose() then repaints
+// dirty widgets and copies the changed, visible parts to the screen back
+// buffer (call it before gfx_flush()).
+void wm_init(u32 background);
+void wm_set_font(const gfx_font_t *f);   // title bars of windows created afterwards
+wm_window_t *wm_create(int x, int y, int w, int h, int flags, const char *title, u32 bg);
+void wm_destroy(wm_window_t *win);
+void wm_raise(wm_window_t *win);
+void wm_move(wm_window_t *win, int x, int y);
+void wm_compose(void);
+wm_window_t *wm_hit(int x, int y, int *lx, int *ly, int *part);
+
+// Widgets: the caller fills x/y/w/h/id/paint/click and keeps the storage
+// alive while the window exists. wm_click() hands a client click to the
+// window's handler, or else to the widget under it; 0 if nobody took it.
+void wm_add_widget(wm_window_t *win, wm_widget_t *wg);
+void wm_invalidate(wm_widget_t *wg);
+int  wm_click(wm_window_t *win, int x, int y);
+
+#endif